@@ -0,0 +1,419 @@
+/*
+ * apex_asm.c
+ *
+ * Two-pass assembler for APEX programs. The output image is installed into
+ * a CPU by cpu_load_program / cpu_load_program_text.
+ */
+
+#include "apex_asm.h"
+#include <stdarg.h>
+#include <limits.h>
+#include <strings.h>
+
+#define ASM_CODE_BASE 4000
+#define ASM_MAX_ERRORS 20
+
+static int asm_code_index(int addr) {
+    if(addr < ASM_CODE_BASE || (addr - ASM_CODE_BASE) % 4 != 0 || (addr - ASM_CODE_BASE) / 4 >= CODE_MEMORY_SIZE) return -1;
+    return (addr - ASM_CODE_BASE) / 4;
+}
+
+typedef struct {
+    const char* name;
+    Opcode op;
+    const char* operands;   // d = rd, s = rs1, S = rs2, i = immediate, t = PC-relative target
+} AsmOpcode;
+
+static const AsmOpcode asmOpcodes[] = {
+    {"ADD", OP_ADD, "dsS"}, {"SUB", OP_SUB, "dsS"}, {"MUL", OP_MUL, "dsS"},
+    {"AND", OP_AND, "dsS"}, {"OR", OP_OR, "dsS"}, {"XOR", OP_XOR, "dsS"},
+    {"ADDL", OP_ADDL, "dsi"}, {"SUBL", OP_SUBL, "dsi"},
+    {"CML", OP_CML, "si"}, {"CMP", OP_CMP, "sS"},
+    {"LOAD", OP_LOAD, "dsi"}, {"STORE", OP_STORE, "sSi"}, {"MOVC", OP_MOVC, "di"},
+    {"JUMP", OP_JUMP, "si"}, {"JAL", OP_JAL, "di"}, {"RET", OP_RET, "s"}, {"JALP", OP_JALP, "dt"},
+    {"BZ", OP_BZ, "t"}, {"BNZ", OP_BNZ, "t"}, {"BP", OP_BP, "t"}, {"BN", OP_BN, "t"},
+    {"NOP", OP_NOP, ""}, {"HALT", OP_HALT, ""},
+};
+
+typedef struct {
+    const char* s;
+    int len;
+} AsmToken;
+
+typedef struct {
+    const char* name;       // points into the source text
+    int len;
+    unsigned int hash;
+    int value;
+} AsmSymbol;
+
+typedef struct {
+    ApexCpu* cpu;
+    const char* file;
+    int line;
+    int pass;
+    int errors;
+    int inData;
+    int codeAddr;
+    long long dataAddr;
+    AsmSymbol* symbols;     // open addressing, capacity a power of two
+    int symbolCap;
+    int symbolCount;
+    unsigned char codeUsed[CODE_MEMORY_SIZE];
+    Instruction* image;     // pass 2 output, by code index
+    int* imageLine;
+    unsigned int* data;     // pass 2 output, (address, value) pairs
+    int dataCount;
+    int dataCap;
+    int instructions;
+} Assembler;
+
+static void asm_verror(Assembler* a, const char* fmt, va_list args) {
+    if(++a->errors > ASM_MAX_ERRORS) return;
+    char msg[256];
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    cpu_log(a->cpu, APEX_LOG_ERROR, "%s:%d: error: %s\n", a->file, a->line, msg);
+}
+
+// Syntax errors, reported by pass 1 only
+static void asm_error(Assembler* a, const char* fmt, ...) {
+    if(a->pass == 2) return;
+    va_list args;
+    va_start(args, fmt);
+    asm_verror(a, fmt, args);
+    va_end(args);
+}
+
+// Symbol errors, which only pass 2 can see
+static void asm_symbol_error(Assembler* a, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    asm_verror(a, fmt, args);
+    va_end(args);
+}
+
+// A single '/' also starts a comment, as it did for the line-by-line loader
+static int asm_is_comment(char c) {
+    return c == ';' || c == '/';
+}
+
+static int asm_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+// Next token on the line; FALSE at the end of the line or a comment
+static int asm_token(const char** p, const char* eol, AsmToken* t) {
+    const char* c = *p;
+    while(c < eol && asm_is_space(*c)) c++;
+    if(c == eol || asm_is_comment(*c)) { *p = eol; return FALSE; }
+    t->s = c;
+    while(c < eol && !asm_is_space(*c) && !asm_is_comment(*c)) c++;
+    t->len = c - t->s;
+    *p = c;
+    return TRUE;
+}
+
+static int asm_ident_char(char c, int first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.' || (!first && c >= '0' && c <= '9');
+}
+
+static int asm_is_register_name(const char* s, int len) {
+    if(len < 2 || (s[0] != 'R' && s[0] != 'r')) return FALSE;
+    for(int k=1; k<len; k++) if(s[k] < '0' || s[k] > '9') return FALSE;
+    return TRUE;
+}
+
+// Parses the whole of s as a decimal or 0x hex number that fits 32 bits
+static int asm_number(const char* s, int len, long long* out) {
+    int k = 0, negative = FALSE;
+    if(k < len && (s[k] == '-' || s[k] == '+')) negative = (s[k++] == '-');
+    int hex = (len - k > 2 && s[k] == '0' && (s[k + 1] == 'x' || s[k + 1] == 'X'));
+    if(hex) k += 2;
+    if(k == len) return FALSE;
+    long long value = 0;
+    for(; k<len; k++) {
+        int digit;
+        if(s[k] >= '0' && s[k] <= '9') digit = s[k] - '0';
+        else if(hex && s[k] >= 'a' && s[k] <= 'f') digit = s[k] - 'a' + 10;
+        else if(hex && s[k] >= 'A' && s[k] <= 'F') digit = s[k] - 'A' + 10;
+        else return FALSE;
+        value = value * (hex ? 16 : 10) + digit;
+        if(value > 0xFFFFFFFFLL) return FALSE;
+    }
+    *out = negative ? -value : value;
+    return TRUE;
+}
+
+static unsigned int asm_hash(const char* s, int len) {
+    unsigned int h = 2166136261u;
+    for(int k=0; k<len; k++) h = (h ^ (unsigned char)s[k]) * 16777619u;
+    return h;
+}
+
+// Slot holding name, or the empty slot where it belongs
+static AsmSymbol* asm_slot(AsmSymbol* table, int cap, const char* name, int len, unsigned int hash) {
+    unsigned int k = hash & (cap - 1);
+    while(table[k].name && (table[k].hash != hash || table[k].len != len || memcmp(table[k].name, name, len))) k = (k + 1) & (cap - 1);
+    return &table[k];
+}
+
+static AsmSymbol* asm_lookup(Assembler* a, const char* name, int len) {
+    if(!a->symbols) return NULL;
+    AsmSymbol* sym = asm_slot(a->symbols, a->symbolCap, name, len, asm_hash(name, len));
+    return sym->name ? sym : NULL;
+}
+
+// Adds a symbol known to be new
+static int asm_define(Assembler* a, const char* name, int len, int value) {
+    if(a->symbolCount * 2 >= a->symbolCap) {
+        int cap = a->symbolCap ? a->symbolCap * 2 : 256;
+        AsmSymbol* table = (AsmSymbol*)calloc(cap, sizeof(AsmSymbol));
+        if(!table) return FALSE;
+        for(int k=0; k<a->symbolCap; k++) {
+            AsmSymbol* old = &a->symbols[k];
+            if(old->name) *asm_slot(table, cap, old->name, old->len, old->hash) = *old;
+        }
+        free(a->symbols);
+        a->symbols = table;
+        a->symbolCap = cap;
+    }
+    unsigned int hash = asm_hash(name, len);
+    AsmSymbol* sym = asm_slot(a->symbols, a->symbolCap, name, len, hash);
+    sym->name = name;
+    sym->len = len;
+    sym->hash = hash;
+    sym->value = value;
+    a->symbolCount++;
+    return TRUE;
+}
+
+static void asm_label(Assembler* a, const char* name, int len) {
+    if(a->pass == 2) return;
+    int ok = len > 0 && asm_ident_char(name[0], TRUE);
+    for(int k=1; k<len && ok; k++) ok = asm_ident_char(name[k], FALSE);
+    if(!ok || asm_is_register_name(name, len)) { asm_error(a, "invalid label '%.*s'", len, name); return; }
+    if(asm_lookup(a, name, len)) { asm_error(a, "label '%.*s' already defined", len, name); return; }
+    if(!asm_define(a, name, len, a->inData ? (int)a->dataAddr : a->codeAddr)) asm_error(a, "out of memory");
+}
+
+static int asm_register(Assembler* a, const AsmToken* t) {
+    long long n;
+    if(asm_is_register_name(t->s, t->len) && asm_number(t->s + 1, t->len - 1, &n) && n < ARCH_REG_FILE_SIZE) return (int)n;
+    asm_error(a, "expected a register R0-R%d, got '%.*s'", ARCH_REG_FILE_SIZE - 1, t->len, t->s);
+    return 0;
+}
+
+// Number or symbol[+-n]. Symbols resolve in pass 2 only; *symbolic tells
+// the caller which form was used.
+static int asm_value(Assembler* a, const AsmToken* t, int* symbolic) {
+    const char* s = t->s;
+    int len = t->len;
+    if(len > 0 && s[0] == '#') { s++; len--; }
+    long long n = 0;
+    *symbolic = FALSE;
+    if(len > 0 && !asm_ident_char(s[0], TRUE)) {
+        if(!asm_number(s, len, &n)) asm_error(a, "bad number '%.*s'", t->len, t->s);
+        return (int)n;
+    }
+    int nameLen = 0;
+    while(nameLen < len && asm_ident_char(s[nameLen], nameLen == 0)) nameLen++;
+    if(nameLen == 0 || (nameLen < len && ((s[nameLen] != '+' && s[nameLen] != '-') || !asm_number(s + nameLen, len - nameLen, &n)))) {
+        asm_error(a, "bad operand '%.*s'", t->len, t->s);
+        return 0;
+    }
+    *symbolic = TRUE;
+    if(a->pass == 1) return 0;
+    AsmSymbol* sym = asm_lookup(a, s, nameLen);
+    if(!sym) { asm_symbol_error(a, "undefined symbol '%.*s'", nameLen, s); return 0; }
+    return sym->value + (int)n;
+}
+
+static void asm_emit_data(Assembler* a, int value) {
+    if(a->dataCount + 2 > a->dataCap) {
+        int cap = a->dataCap ? a->dataCap * 2 : 1024;
+        unsigned int* data = (unsigned int*)realloc(a->data, cap * sizeof(unsigned int));
+        if(!data) { asm_symbol_error(a, "out of memory"); return; }
+        a->data = data;
+        a->dataCap = cap;
+    }
+    a->data[a->dataCount++] = (unsigned int)a->dataAddr;
+    a->data[a->dataCount++] = (unsigned int)value;
+}
+
+static void asm_directive(Assembler* a, const AsmToken* dir, const char* p, const char* eol) {
+    AsmToken t;
+    long long n;
+    int isData = (dir->len == 5 && !strncasecmp(dir->s, ".data", 5));
+    if(isData || (dir->len == 5 && !strncasecmp(dir->s, ".text", 5))) {
+        a->inData = isData;
+        if(!asm_token(&p, eol, &t)) return;
+        if(!isData) { asm_error(a, "unexpected '%.*s' after .text", t.len, t.s); return; }
+        if(!asm_number(t.s, t.len, &n) || n < 0) { asm_error(a, ".data address must be a non-negative number"); return; }
+        a->dataAddr = n;
+    } else if(dir->len == 4 && !strncasecmp(dir->s, ".org", 4)) {
+        if(!asm_token(&p, eol, &t) || !asm_number(t.s[0] == '#' ? t.s + 1 : t.s, t.len - (t.s[0] == '#'), &n)) {
+            asm_error(a, ".org needs a numeric address");
+            return;
+        }
+        if(a->inData) {
+            if(n < 0) { asm_error(a, ".org data address must be non-negative"); return; }
+            a->dataAddr = n;
+        } else {
+            if(n < INT_MIN || n > INT_MAX || asm_code_index((int)n) < 0) {
+                asm_error(a, ".org %lld is not a code address (%d..%d, multiple of 4)", n, ASM_CODE_BASE,
+                          ASM_CODE_BASE + 4 * (CODE_MEMORY_SIZE - 1));
+                return;
+            }
+            a->codeAddr = (int)n;
+        }
+    } else if(dir->len == 5 && !strncasecmp(dir->s, ".word", 5)) {
+        if(!a->inData) { asm_error(a, ".word outside a .data section"); return; }
+        int count = 0, symbolic;
+        while(asm_token(&p, eol, &t)) {
+            int value = asm_value(a, &t, &symbolic);
+            if(a->pass == 2) asm_emit_data(a, value);
+            a->dataAddr++;
+            count++;
+        }
+        if(count == 0) asm_error(a, ".word needs at least one value");
+        return;
+    } else {
+        asm_error(a, "unknown directive '%.*s'", dir->len, dir->s);
+        return;
+    }
+    if(asm_token(&p, eol, &t)) asm_error(a, "unexpected '%.*s'", t.len, t.s);
+}
+
+static void asm_instruction(Assembler* a, const AsmToken* mnemonic, const char* p, const char* eol) {
+    const AsmOpcode* def = NULL;
+    for(size_t k=0; k<sizeof(asmOpcodes)/sizeof(asmOpcodes[0]); k++) {
+        if((int)strlen(asmOpcodes[k].name) == mnemonic->len && !strncasecmp(asmOpcodes[k].name, mnemonic->s, mnemonic->len)) {
+            def = &asmOpcodes[k];
+            break;
+        }
+    }
+    if(!def) { asm_error(a, "unknown instruction '%.*s'", mnemonic->len, mnemonic->s); return; }
+    if(a->inData) { asm_error(a, "instruction in a .data section"); return; }
+    int idx = asm_code_index(a->codeAddr);
+    if(idx < 0) { asm_error(a, "code does not fit in %d instructions", CODE_MEMORY_SIZE); return; }
+    
+    Instruction in;
+    memset(&in, 0, sizeof(in));
+    in.opcode = def->op;
+    snprintf(in.opcodeStr, sizeof(in.opcodeStr), "%s", def->name);
+    in.pc = a->codeAddr;
+    in.rd = -1; in.rs1 = -1; in.rs2 = -1;
+    in.physRd = -1; in.physRs1 = -1; in.physRs2 = -1;
+    in.physCc = -1; in.physSrcCc = -1;
+    in.robIndex = -1; in.lsqIndex = -1; in.bisIndex = -1;
+    
+    int expected = strlen(def->operands), given = 0;
+    AsmToken t;
+    while(asm_token(&p, eol, &t)) {
+        if(given++ >= expected) continue;
+        int symbolic;
+        switch(def->operands[given - 1]) {
+            case 'd': in.rd = asm_register(a, &t); break;
+            case 's': in.rs1 = asm_register(a, &t); break;
+            case 'S': in.rs2 = asm_register(a, &t); break;
+            case 'i': in.imm = asm_value(a, &t, &symbolic); break;
+            case 't':
+                in.imm = asm_value(a, &t, &symbolic);
+                if(symbolic) in.imm -= in.pc;
+                break;
+        }
+    }
+    if(given != expected) {
+        asm_error(a, "%s takes %d operand%s, got %d", def->name, expected, expected == 1 ? "" : "s", given);
+        return;
+    }
+    if(a->pass == 1) {
+        if(a->codeUsed[idx]) asm_error(a, "address %d already holds an instruction", a->codeAddr);
+        a->codeUsed[idx] = TRUE;
+    } else {
+        a->image[idx] = in;
+        a->imageLine[idx] = a->line;
+        a->instructions++;
+    }
+    a->codeAddr += 4;
+}
+
+static void asm_pass(Assembler* a, const char* text, size_t length, int pass) {
+    const char* p = text;
+    const char* end = text + length;
+    a->pass = pass;
+    a->line = 0;
+    a->inData = FALSE;
+    a->codeAddr = ASM_CODE_BASE;
+    a->dataAddr = 0;
+    while(p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+        const char* next = (eol < end) ? eol + 1 : end;
+        a->line++;
+        AsmToken t;
+        if(asm_token(&p, eol, &t)) {
+            while(t.len > 1 && t.s[t.len - 1] == ':') {
+                asm_label(a, t.s, t.len - 1);
+                if(!asm_token(&p, eol, &t)) { t.len = 0; break; }
+            }
+            if(t.len > 0 && t.s[0] == '.') asm_directive(a, &t, p, eol);
+            else if(t.len > 0) asm_instruction(a, &t, p, eol);
+        }
+        p = next;
+    }
+}
+
+int apex_asm_assemble(ApexCpu* cpu, const char* file, const char* text, size_t length, ApexAsmImage* image) {
+    memset(image, 0, sizeof(ApexAsmImage));
+    Assembler* a = (Assembler*)calloc(1, sizeof(Assembler));
+    if(!a) return -1;
+    a->cpu = cpu;
+    a->file = file;
+    asm_pass(a, text, length, 1);
+    // Pass 2 runs even after syntax errors, to report undefined symbols too
+    a->image = (Instruction*)malloc(CODE_MEMORY_SIZE * sizeof(Instruction));
+    a->imageLine = (int*)calloc(CODE_MEMORY_SIZE, sizeof(int));
+    if(!a->image || !a->imageLine) {
+        a->errors++;
+    } else {
+        // Unused code memory holds NOPs, so wrong-path fetch past the end is harmless
+        Instruction nop;
+        memset(&nop, 0, sizeof(nop));
+        nop.opcode = OP_NOP;
+        strcpy(nop.opcodeStr, "NOP");
+        nop.rd = -1; nop.rs1 = -1; nop.rs2 = -1;
+        nop.physRd = -1; nop.physRs1 = -1; nop.physRs2 = -1;
+        nop.physCc = -1; nop.physSrcCc = -1;
+        nop.robIndex = -1; nop.lsqIndex = -1; nop.bisIndex = -1;
+        for(int k=0; k<CODE_MEMORY_SIZE; k++) {
+            nop.pc = ASM_CODE_BASE + 4 * k;
+            a->image[k] = nop;
+        }
+        asm_pass(a, text, length, 2);
+    }
+    int loaded = -1;
+    if(a->errors == 0) {
+        image->code = a->image;
+        image->sourceLine = a->imageLine;
+        image->data = a->data;
+        image->dataCount = a->dataCount;
+        image->instructions = a->instructions;
+        loaded = a->instructions;
+    } else {
+        if(a->errors > ASM_MAX_ERRORS) cpu_log(cpu, APEX_LOG_ERROR, "%s: %d errors, first %d shown\n", file, a->errors, ASM_MAX_ERRORS);
+        free(a->image);
+        free(a->imageLine);
+        free(a->data);
+    }
+    free(a->symbols);
+    free(a);
+    return loaded;
+}
+
+void apex_asm_release(ApexAsmImage* image) {
+    free(image->code);
+    free(image->sourceLine);
+    free(image->data);
+    memset(image, 0, sizeof(ApexAsmImage));
+}
@@ -0,0 +1,34 @@
+#ifndef APEX_ASM_H
+#define APEX_ASM_H
+
+#include "apex_cpu.h"
+
+// Two passes over the source: the first gives every label an address, the
+// second encodes instructions and .word data against the complete symbol
+// table. Nothing is loaded unless the whole program assembles.
+//
+//   label:  MNEMONIC operands       / or // or ; starts a comment
+//   .text                           assemble code (the default, from 4000)
+//   .data [addr]                    assemble data words, from addr or 0
+//   .org addr                       move the current section's location
+//   .word v, v, ...                 data words: numbers or symbols
+//
+// Registers are R0-R31. Immediates take an optional '#' and are decimal,
+// 0x hex or symbol[+-n]. A symbol used as a branch or JALP target becomes
+// the PC-relative offset; numeric targets are offsets as before.
+
+typedef struct {
+    Instruction* code;      // CODE_MEMORY_SIZE slots; unused ones hold NOPs
+    int* sourceLine;        // 1-based source line per slot, 0 if unused
+    unsigned int* data;     // .word output as (address, value) pairs
+    int dataCount;          // entries in data, two per word
+    int instructions;
+} ApexAsmImage;
+
+// Assembles text into image, logging errors as file:line through cpu's
+// logger. Returns the number of instructions, or -1 if anything failed to
+// assemble; image then holds nothing to release.
+int apex_asm_assemble(ApexCpu* cpu, const char* file, const char* text, size_t length, ApexAsmImage* image);
+void apex_asm_release(ApexAsmImage* image);
+
+#endif
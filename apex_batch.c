@@ -0,0 +1,73 @@
+/*
+ * apex_batch.c
+ *
+ * Batch of CPUs for parameter sweeps on one program.
+ */
+
+#include "apex_batch.h"
+
+int apex_batch_init(ApexBatch* b, const ApexConfig* configs, int count) {
+    memset(b, 0, sizeof(ApexBatch));
+    b->roundCycles = BATCH_ROUND_CYCLES;
+    if(count < 1 || count > BATCH_MAX_LANES) return FALSE;
+    for(int k=0; k<count; k++) {
+        b->lanes[k] = cpu_create(&configs[k]);
+        if(!b->lanes[k]) {
+            apex_batch_release(b);
+            return FALSE;
+        }
+        b->count++;
+    }
+    return TRUE;
+}
+
+// The source is read once and assembled into every lane. Diagnostics come
+// from the first lane only, since every lane would report the same ones.
+int apex_batch_load_program(ApexBatch* b, const char* path, int predictor) {
+    FILE* f = fopen(path, "rb");
+    if(!f) {
+        cpu_log(b->lanes[0], APEX_LOG_ERROR, "Error opening file %s\n", path);
+        return FALSE;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = (char*)malloc(size > 0 ? size : 1);
+    int ok = text && fread(text, 1, size, f) == (size_t)size;
+    fclose(f);
+    for(int k=0; ok && k<b->count; k++) {
+        ok = cpu_load_program_text(b->lanes[k], text, size) >= 0;
+        b->lanes[k]->predictor_enabled = predictor;
+    }
+    free(text);
+    return ok;
+}
+
+// Runs every lane until it halts or has simulated maxCycles (0 = no
+// limit). Returns the cycles simulated across all lanes.
+long long apex_batch_run(ApexBatch* b, long long maxCycles) {
+    long long total = 0;
+    if(b->roundCycles <= 0) {
+        for(int k=0; k<b->count; k++) total += cpu_run_until(b->lanes[k], NULL, NULL, maxCycles);
+        return total;
+    }
+    long long round = 0;
+    int active = b->count;
+    while(active > 0 && (maxCycles <= 0 || round < maxCycles)) {
+        long long cycles = b->roundCycles;
+        if(maxCycles > 0 && cycles > maxCycles - round) cycles = maxCycles - round;
+        active = 0;
+        for(int k=0; k<b->count; k++) {
+            if(cpu_halted(b->lanes[k])) continue;
+            total += cpu_step(b->lanes[k], cycles);
+            active += !cpu_halted(b->lanes[k]);
+        }
+        round += cycles;
+    }
+    return total;
+}
+
+void apex_batch_release(ApexBatch* b) {
+    for(int k=0; k<b->count; k++) cpu_destroy(b->lanes[k]);
+    b->count = 0;
+}
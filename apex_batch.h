@@ -0,0 +1,27 @@
+#ifndef APEX_BATCH_H
+#define APEX_BATCH_H
+
+#include "apex_cpu.h"
+
+// A batch is a sweep driver: it runs one program on several CPUs (lanes),
+// one per configuration. Lanes take turns in rounds of roundCycles
+// (BATCH_ROUND_CYCLES by default), so every point of a sweep advances
+// evenly; a lane that halts drops out of the rounds. Each lane steps on
+// its own scalar cycle loop; nothing is vectorized across lanes.
+// roundCycles = 0 runs each lane to completion in turn instead.
+
+#define BATCH_MAX_LANES 64
+#define BATCH_ROUND_CYCLES 256
+
+typedef struct {
+    int count;
+    long long roundCycles;
+    ApexCpu* lanes[BATCH_MAX_LANES];
+} ApexBatch;
+
+int apex_batch_init(ApexBatch* b, const ApexConfig* configs, int count);
+int apex_batch_load_program(ApexBatch* b, const char* path, int predictor);
+long long apex_batch_run(ApexBatch* b, long long maxCycles);
+void apex_batch_release(ApexBatch* b);
+
+#endif
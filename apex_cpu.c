@@ -3,25 +3,79 @@
  * Contains APEX CPU pipeline implementation
  */
 #include "apex_cpu.h"
+#include "apex_asm.h"
+#include <stddef.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <errno.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 // --------------------------------------------------------------------
 // CONFIGURATION
 // --------------------------------------------------------------------
 #define MAX_CYCLES 200 
 
-Instruction* create_instruction() {
-    Instruction* instr = (Instruction*)malloc(sizeof(Instruction));
-    memset(instr, 0, sizeof(Instruction));
-    instr->opcode = OP_NOP;
-    strcpy(instr->opcodeStr, "NOP");
-    instr->rd = -1; instr->rs1 = -1; instr->rs2 = -1;
-    instr->physRd = -1; instr->physRs1 = -1; instr->physRs2 = -1;
-    instr->physCc = -1; instr->physSrcCc = -1;
-    instr->robIndex = -1; instr->lsqIndex = -1; instr->bisIndex = -1;
-    return instr;
+// --------------------------------------------------------------------
+// LOGGING AND HOOKS
+// --------------------------------------------------------------------
+static void cpu_vlog(ApexCpu* cpu, int level, const char* fmt, va_list args) {
+    if(level > cpu->logLevel) return;
+    char text[512];
+    vsnprintf(text, sizeof(text), fmt, args);
+    if(cpu->logFn) cpu->logFn(cpu->logUser, level, text);
+    else fputs(text, stdout);
+}
+
+void cpu_log(ApexCpu* cpu, int level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    cpu_vlog(cpu, level, fmt, args);
+    va_end(args);
+}
+
+// Display output (pipeline and statistics tables) is logged at INFO
+static void cpu_print(ApexCpu* cpu, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    cpu_vlog(cpu, APEX_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+// Features a cycle kernel is specialized on. Specialized kernels pass a
+// constant spec down through the always-inlined stages so the checks fold
+// away; the generic kernel tests the CPU's own settings every cycle.
+typedef struct {
+    int predictor;      // predictor_enabled
+    int timedFetch;     // an I-cache or ITLB may delay fetch
+    int timedData;      // a DTLB may delay the MAU
+    int extras;         // fusion, loop buffer, value prediction, ROB-walk recovery or early resolution may be on
+} KernelSpec;
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static inline void cpu_hook(ApexCpu* cpu, ApexHookEvent event, const Instruction* instr) {
+    if(cpu->hooks[event].fn) cpu->hooks[event].fn(cpu, event, instr, cpu->hooks[event].user);
+}
+
+// In-flight instructions are recycled through a small per-CPU pool, since
+// fetch needs a new one nearly every cycle. Callers overwrite the contents.
+static Instruction* instr_alloc(ApexCpu* cpu) {
+    if(cpu->instrPoolCount > 0) return cpu->instrPool[--cpu->instrPoolCount];
+    return (Instruction*)malloc(sizeof(Instruction));
 }
 
-void print_instruction_str(Instruction* instr, char* buffer) {
+static void instr_free(ApexCpu* cpu, Instruction* instr) {
+    if(!instr) return;
+    if(cpu->instrPoolCount < INSTR_POOL_SIZE) cpu->instrPool[cpu->instrPoolCount++] = instr;
+    else free(instr);
+}
+
+static void print_instruction_str(Instruction* instr, char* buffer) {
     if (!instr) {
         strcpy(buffer, "(Empty)");
         return;
@@ -33,34 +87,51 @@ void print_instruction_str(Instruction* instr, char* buffer) {
     if (instr->imm != 0) sprintf(buffer + strlen(buffer), " #%d", instr->imm);
 }
 
-void queue_init(IntQueue* q) {
-    q->head = 0; 
-    q->tail = 0; 
-    q->count = 0;
+static inline int bitmap_test(const RegBitmap* b, int i) { return (b->bits[i >> 6] >> (i & 63)) & 1; }
+static inline void bitmap_set(RegBitmap* b, int i) { b->bits[i >> 6] |= 1ULL << (i & 63); }
+static inline void bitmap_clear(RegBitmap* b, int i) { b->bits[i >> 6] &= ~(1ULL << (i & 63)); }
+static inline int bitmap_is_empty(const RegBitmap* b) {
+    for(int w=0; w<REG_BITMAP_WORDS; w++) if(b->bits[w]) return FALSE;
+    return TRUE;
 }
-void queue_enqueue(IntQueue* q, int val) {
-    q->items[q->tail] = val;
-    q->tail = (q->tail + 1) %(PHYS_REG_FILE_SIZE+ 1);
-    q->count++;
+// Clears and returns the lowest set bit, -1 when none is set
+static inline int bitmap_take_first(RegBitmap* b) {
+    for(int w=0; w<REG_BITMAP_WORDS; w++) {
+        if(b->bits[w]) {
+            int bit = __builtin_ctzll(b->bits[w]);
+            b->bits[w] &= b->bits[w] - 1;
+            return w * 64 + bit;
+        }
+    }
+    return -1;
 }
-int queue_dequeue(IntQueue* q) {
-    if (q->count == 0) return -1;
-    int val = q->items[q->head];
-    q->head = (q->head + 1) %(PHYS_REG_FILE_SIZE +1);
-    q->count--;
-    return val;
+
+static void stack_init(IntStack* s) { s->top = -1; }
+static void stack_push(IntStack* s, int val) {
+    int depth = sizeof(s->items) / sizeof(s->items[0]);
+    if(s->top == depth - 1) {
+        // Full: drop the oldest return address
+        memmove(s->items, s->items + 1, (depth - 1) * sizeof(int));
+        s->top--;
+    }
+    s->items[++(s->top)] = val;
 }
-int queue_is_empty(IntQueue* q) { return q->count == 0; }
+static int stack_pop(IntStack* s) { return (s->top >= 0) ? s->items[(s->top)--] : 0; }
+static int stack_peek(IntStack* s) { return (s->top >= 0) ? s->items[s->top] : 0; }
+static int stack_is_empty(IntStack* s) { return s->top == -1; }
 
-void stack_init(IntStack* s) { s->top = -1; }
-void stack_push(IntStack* s, int val) { s->items[++(s->top)] = val; }
-int stack_pop(IntStack* s) { return (s->top >= 0) ? s->items[(s->top)--] : 0; }
-int stack_peek(IntStack* s) { return (s->top >= 0) ? s->items[s->top] : 0; }
-int stack_is_empty(IntStack* s) { return s->top == -1; }
+static int code_index(int pc) {
+    if(pc < 4000 || (pc - 4000) % 4 != 0 || (pc - 4000) / 4 >= CODE_MEMORY_SIZE) return -1;
+    return (pc - 4000) / 4;
+}
 
 void cpu_init(ApexCpu* cpu) {
     memset(cpu, 0, sizeof(ApexCpu));
     cpu->pc = 4000;
+    cpu->logLevel = APEX_LOG_INFO;
+    ApexConfig defaults;
+    cpu_config_defaults(&defaults);
+    cpu_configure(cpu, &defaults);
     
     // Default flag to false (will be set by main)
     cpu->predictor_enabled = 0; 
@@ -68,16 +139,13 @@ void cpu_init(ApexCpu* cpu) {
     for(int i=0; i<ARCH_REG_FILE_SIZE; i++) cpu->rat[i] = -1;
     cpu->ratCc = -1;
     
-    queue_init(&cpu->freeListPrf);
     for(int i=0; i<PHYS_REG_FILE_SIZE; i++) {
-        cpu->prf[i].valid = 1;
-        queue_enqueue(&cpu->freeListPrf, i);
+        bitmap_set(&cpu->prfValid, i);
+        bitmap_set(&cpu->freeListPrf, i);
     }
-    
-    queue_init(&cpu->freeListCprf);
     for(int i=0; i<CC_REG_FILE_SIZE; i++) {
-        cpu->cprf[i].valid = 1;
-        queue_enqueue(&cpu->freeListCprf, i);
+        bitmap_set(&cpu->cprfValid, i);
+        bitmap_set(&cpu->freeListCprf, i);
     }
     
     for(int i=0; i<ROB_SIZE; i++) {
@@ -96,10 +164,562 @@ void cpu_init(ApexCpu* cpu) {
         cpu->ctp[i].lruTime = 0;
     }
     stack_init(&cpu->rap);
-    printf("APEX CPU Initialized\n");
+    cpu->profFrameCount = 1;    // frame 0 is the program entry
+}
+
+// --------------------------------------------------------------------
+// MACHINE CONFIGURATION
+// --------------------------------------------------------------------
+typedef struct {
+    const char* name;
+    size_t offset;
+} ConfigOption;
+
+static const ConfigOption configOptions[] = {
+    {"max_cycles", offsetof(ApexConfig, maxCycles)},
+    {"icache_size", offsetof(ApexConfig, icacheSize)},
+    {"icache_assoc", offsetof(ApexConfig, icacheAssoc)},
+    {"icache_line", offsetof(ApexConfig, icacheLineSize)},
+    {"icache_miss_latency", offsetof(ApexConfig, icacheMissLatency)},
+    {"itlb_entries", offsetof(ApexConfig, itlbEntries)},
+    {"itlb_miss_latency", offsetof(ApexConfig, itlbMissLatency)},
+    {"page_size", offsetof(ApexConfig, pageSize)},
+    {"dmem_size", offsetof(ApexConfig, dmemSize)},
+    {"dtlb_entries", offsetof(ApexConfig, dtlbEntries)},
+    {"ptw_latency", offsetof(ApexConfig, ptwLatency)},
+    {"mem_limit", offsetof(ApexConfig, memLimit)},
+    {"mem_fault_trap", offsetof(ApexConfig, memFaultTrap)},
+    {"ff_engine", offsetof(ApexConfig, ffEngine)},
+    {"bis_entries", offsetof(ApexConfig, bisEntries)},
+    {"rob_walk", offsetof(ApexConfig, robWalk)},
+    {"rob_walk_width", offsetof(ApexConfig, robWalkWidth)},
+    {"redirect_penalty", offsetof(ApexConfig, redirectPenalty)},
+    {"early_resolve", offsetof(ApexConfig, earlyResolve)},
+    {"value_pred", offsetof(ApexConfig, valuePred)},
+    {"vp_entries", offsetof(ApexConfig, vpEntries)},
+    {"vp_threshold", offsetof(ApexConfig, vpThreshold)},
+    {"fusion", offsetof(ApexConfig, fusion)},
+    {"lsd_size", offsetof(ApexConfig, lsdSize)},
+    {"idle_skip", offsetof(ApexConfig, idleSkip)},
+    {"specialize", offsetof(ApexConfig, specialize)},
+    {"prf_read_ports", offsetof(ApexConfig, prfReadPorts)},
+    {"prf_write_ports", offsetof(ApexConfig, prfWritePorts)},
+    {"bypass", offsetof(ApexConfig, bypass)},
+    {"wakeup_delay", offsetof(ApexConfig, wakeupDelay)},
+    {"store_buffer", offsetof(ApexConfig, storeBuffer)},
+    {"clock_mhz", offsetof(ApexConfig, clockMhz)},
+    {"energy_fetch", offsetof(ApexConfig, energy[ACC_FETCH])},
+    {"energy_lsd", offsetof(ApexConfig, energy[ACC_LSD])},
+    {"energy_btb", offsetof(ApexConfig, energy[ACC_BTB])},
+    {"energy_ctp", offsetof(ApexConfig, energy[ACC_CTP])},
+    {"energy_tlb", offsetof(ApexConfig, energy[ACC_TLB])},
+    {"energy_rat_read", offsetof(ApexConfig, energy[ACC_RAT_READ])},
+    {"energy_rat_write", offsetof(ApexConfig, energy[ACC_RAT_WRITE])},
+    {"energy_checkpoint", offsetof(ApexConfig, energy[ACC_CHECKPOINT])},
+    {"energy_arf_read", offsetof(ApexConfig, energy[ACC_ARF_READ])},
+    {"energy_arf_write", offsetof(ApexConfig, energy[ACC_ARF_WRITE])},
+    {"energy_prf_read", offsetof(ApexConfig, energy[ACC_PRF_READ])},
+    {"energy_prf_write", offsetof(ApexConfig, energy[ACC_PRF_WRITE])},
+    {"energy_cprf_read", offsetof(ApexConfig, energy[ACC_CPRF_READ])},
+    {"energy_cprf_write", offsetof(ApexConfig, energy[ACC_CPRF_WRITE])},
+    {"energy_rs_write", offsetof(ApexConfig, energy[ACC_RS_WRITE])},
+    {"energy_rs_compare", offsetof(ApexConfig, energy[ACC_RS_COMPARE])},
+    {"energy_rs_read", offsetof(ApexConfig, energy[ACC_RS_READ])},
+    {"energy_rob_read", offsetof(ApexConfig, energy[ACC_ROB_READ])},
+    {"energy_rob_write", offsetof(ApexConfig, energy[ACC_ROB_WRITE])},
+    {"energy_lsq_write", offsetof(ApexConfig, energy[ACC_LSQ_WRITE])},
+    {"energy_lsq_search", offsetof(ApexConfig, energy[ACC_LSQ_SEARCH])},
+    {"energy_sb", offsetof(ApexConfig, energy[ACC_SB])},
+    {"energy_vp", offsetof(ApexConfig, energy[ACC_VP])},
+    {"energy_alu", offsetof(ApexConfig, energy[ACC_ALU])},
+    {"energy_mul", offsetof(ApexConfig, energy[ACC_MUL])},
+    {"energy_mem_read", offsetof(ApexConfig, energy[ACC_MEM_READ])},
+    {"energy_mem_write", offsetof(ApexConfig, energy[ACC_MEM_WRITE])},
+};
+
+// Default energy per access in femtojoules: rough figures for a small
+// core in a recent process, meant for comparing configurations rather
+// than as absolute numbers
+static const int defaultEnergy[ACC_COUNT] = {
+    [ACC_FETCH] = 6000,
+    [ACC_LSD] = 1000,
+    [ACC_BTB] = 1500,
+    [ACC_CTP] = 800,
+    [ACC_TLB] = 1200,
+    [ACC_RAT_READ] = 600,
+    [ACC_RAT_WRITE] = 800,
+    [ACC_CHECKPOINT] = 5000,
+    [ACC_ARF_READ] = 1500,
+    [ACC_ARF_WRITE] = 2000,
+    [ACC_PRF_READ] = 2000,
+    [ACC_PRF_WRITE] = 2500,
+    [ACC_CPRF_READ] = 300,
+    [ACC_CPRF_WRITE] = 400,
+    [ACC_RS_WRITE] = 1500,
+    [ACC_RS_COMPARE] = 150,
+    [ACC_RS_READ] = 1200,
+    [ACC_ROB_READ] = 1800,
+    [ACC_ROB_WRITE] = 2200,
+    [ACC_LSQ_WRITE] = 1500,
+    [ACC_LSQ_SEARCH] = 2500,
+    [ACC_SB] = 2000,
+    [ACC_VP] = 1500,
+    [ACC_ALU] = 3000,
+    [ACC_MUL] = 12000,
+    [ACC_MEM_READ] = 25000,
+    [ACC_MEM_WRITE] = 28000,
+};
+
+void cpu_config_defaults(ApexConfig* cfg) {
+    memset(cfg, 0, sizeof(ApexConfig));
+    cfg->maxCycles = MAX_CYCLES;
+    cfg->icacheSize = 0;
+    cfg->icacheAssoc = 2;
+    cfg->icacheLineSize = 16;
+    cfg->icacheMissLatency = 10;
+    cfg->itlbEntries = 0;
+    cfg->itlbMissLatency = 20;
+    cfg->pageSize = 4096;
+    cfg->dmemSize = DATA_MEMORY_SIZE;
+    cfg->dtlbEntries = 0;
+    cfg->ptwLatency = 20;
+    cfg->memLimit = 0;
+    cfg->memFaultTrap = TRUE;
+    cfg->ffEngine = 1;
+    cfg->bisEntries = 8;
+    cfg->robWalk = FALSE;
+    cfg->robWalkWidth = 4;
+    cfg->redirectPenalty = 0;
+    cfg->earlyResolve = FALSE;
+    cfg->valuePred = VP_OFF;
+    cfg->vpEntries = 64;
+    cfg->vpThreshold = 2;
+    cfg->fusion = FALSE;
+    cfg->lsdSize = 0;
+    cfg->idleSkip = TRUE;
+    cfg->specialize = TRUE;
+    cfg->prfReadPorts = 0;
+    cfg->prfWritePorts = 0;
+    cfg->bypass = BYPASS_FULL;
+    cfg->wakeupDelay = 0;
+    cfg->storeBuffer = 0;
+    cfg->clockMhz = 1000;
+    memcpy(cfg->energy, defaultEnergy, sizeof(cfg->energy));
+}
+
+// Parses a single "key=value" option into cfg. Returns FALSE on unknown keys
+// and on values that are not a non-negative decimal int; cfg is unchanged.
+int cpu_config_set(ApexConfig* cfg, const char* option) {
+    const char* eq = strchr(option, '=');
+    if(!eq) return FALSE;
+    size_t keyLen = eq - option;
+    for(size_t i=0; i<sizeof(configOptions)/sizeof(configOptions[0]); i++) {
+        if(strlen(configOptions[i].name) == keyLen && !strncmp(configOptions[i].name, option, keyLen)) {
+            char* end;
+            errno = 0;
+            long value = strtol(eq + 1, &end, 10);
+            if(end == eq + 1 || *end != '\0' || errno == ERANGE || value < 0 || value > INT_MAX) return FALSE;
+            *(int*)((char*)cfg + configOptions[i].offset) = (int)value;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int cpu_configure(ApexCpu* cpu, const ApexConfig* cfg) {
+    if(cfg->icacheSize > 0) {
+        if(cfg->icacheLineSize < 4 || cfg->icacheAssoc < 1) {
+            cpu_log(cpu, APEX_LOG_ERROR, "Error: icache_line must be >= 4 and icache_assoc >= 1\n");
+            return FALSE;
+        }
+        int lines = cfg->icacheSize / cfg->icacheLineSize;
+        if(lines < cfg->icacheAssoc || lines > ICACHE_MAX_LINES || lines % cfg->icacheAssoc != 0) {
+            cpu_log(cpu, APEX_LOG_ERROR, "Error: icache geometry needs 1..%d lines and a multiple of icache_assoc\n", ICACHE_MAX_LINES);
+            return FALSE;
+        }
+    }
+    if(cfg->itlbEntries < 0 || cfg->itlbEntries > TLB_MAX_ENTRIES || cfg->pageSize < 4) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: itlb_entries must be 0..%d and page_size >= 4\n", TLB_MAX_ENTRIES);
+        return FALSE;
+    }
+    if(cfg->dtlbEntries < 0 || cfg->dtlbEntries > TLB_MAX_ENTRIES || cfg->dmemSize < PAGE_WORDS || cfg->memLimit < 0) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: dtlb_entries must be 0..%d, dmem_size >= %d words, mem_limit >= 0\n", TLB_MAX_ENTRIES, PAGE_WORDS);
+        return FALSE;
+    }
+    if(cfg->bisEntries < 1 || cfg->bisEntries > BIS_SIZE || cfg->robWalkWidth < 1 || cfg->redirectPenalty < 0) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: bis_entries must be 1..%d, rob_walk_width >= 1, redirect_penalty >= 0\n", BIS_SIZE);
+        return FALSE;
+    }
+    if(cfg->valuePred < VP_OFF || cfg->valuePred > VP_STRIDE || cfg->vpEntries < 1 || cfg->vpEntries > VP_MAX_ENTRIES ||
+       (cfg->vpEntries & (cfg->vpEntries - 1)) || cfg->vpThreshold < 0 || cfg->vpThreshold > VP_MAX_CONFIDENCE) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: value_pred must be 0..2, vp_entries a power of two up to %d, vp_threshold 0..%d\n",
+                VP_MAX_ENTRIES, VP_MAX_CONFIDENCE);
+        return FALSE;
+    }
+    if(cfg->lsdSize < 0 || cfg->lsdSize > LSD_MAX_OPS) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: lsd_size must be 0..%d\n", LSD_MAX_OPS);
+        return FALSE;
+    }
+    // An instruction reads at most two registers, so one read port could never issue it
+    if(cfg->prfReadPorts < 0 || cfg->prfReadPorts == 1 || cfg->prfWritePorts < 0 ||
+       cfg->bypass < BYPASS_NONE || cfg->bypass > BYPASS_FULL || cfg->wakeupDelay < 0) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: prf_read_ports must be 0 or >= 2, prf_write_ports >= 0, bypass 0..2, wakeup_delay >= 0\n");
+        return FALSE;
+    }
+    if(cfg->storeBuffer < 0 || cfg->storeBuffer > STORE_BUFFER_MAX) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: store_buffer must be 0..%d\n", STORE_BUFFER_MAX);
+        return FALSE;
+    }
+    int energyOk = cfg->clockMhz > 0;
+    for(int k=0; k<ACC_COUNT; k++) energyOk = energyOk && cfg->energy[k] >= 0;
+    if(!energyOk) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: clock_mhz must be > 0 and energy_* >= 0\n");
+        return FALSE;
+    }
+    cpu_release(cpu);
+    cpu->config = *cfg;
+    // A ROB walk needs no checkpoints, so only the ROB bounds branches in flight
+    cpu->bisLimit = cfg->robWalk ? BIS_SIZE : cfg->bisEntries;
+    cpu->frameCount = cfg->dmemSize / PAGE_WORDS;
+    cpu->frames = (int**)calloc(cpu->frameCount, sizeof(int*));
+    memset(cpu->icache, 0, sizeof(cpu->icache));
+    memset(cpu->itlb, 0, sizeof(cpu->itlb));
+    memset(cpu->dtlb, 0, sizeof(cpu->dtlb));
+    memset(cpu->valuePred, 0, sizeof(cpu->valuePred));
+    cpu->icacheSets = (cfg->icacheSize > 0) ? (cfg->icacheSize / cfg->icacheLineSize) / cfg->icacheAssoc : 0;
+    cpu->fetchMissPc = -1;
+    cpu->cycleKernel[0] = cpu->cycleKernel[1] = NULL;     // reselected on the next cycle
+    return TRUE;
+}
+
+// --------------------------------------------------------------------
+// FRONT END: L1 INSTRUCTION CACHE + ITLB
+// --------------------------------------------------------------------
+// Fully associative, LRU. Returns TRUE on hit; a miss installs the page.
+static int tlb_access(TlbEntry* tlb, int entries, int vpn, int clock) {
+    int lru = -1, empty = -1, minTime = 2147483647;
+    for(int i=0; i<entries; i++) {
+        if(!tlb[i].valid) { if(empty == -1) empty = i; }
+        else {
+            if(tlb[i].vpn == vpn) { tlb[i].lruTime = clock; return TRUE; }
+            if(tlb[i].lruTime < minTime) { minTime = tlb[i].lruTime; lru = i; }
+        }
+    }
+    int idx = (empty != -1) ? empty : lru;
+    tlb[idx].valid = TRUE;
+    tlb[idx].vpn = vpn;
+    tlb[idx].lruTime = clock;
+    return FALSE;
+}
+
+// Set associative, LRU. Returns TRUE on hit; a miss fills the line.
+static int icache_access(ApexCpu* cpu, int pc) {
+    unsigned int line = (unsigned int)pc / cpu->config.icacheLineSize;
+    int assoc = cpu->config.icacheAssoc;
+    int tag = line / cpu->icacheSets;
+    CacheLine* set = &cpu->icache[(line % cpu->icacheSets) * assoc];
+    int lru = -1, empty = -1, minTime = 2147483647;
+    for(int w=0; w<assoc; w++) {
+        if(!set[w].valid) { if(empty == -1) empty = w; }
+        else {
+            if(set[w].tag == tag) { set[w].lruTime = cpu->clock; return TRUE; }
+            if(set[w].lruTime < minTime) { minTime = set[w].lruTime; lru = w; }
+        }
+    }
+    int idx = (empty != -1) ? empty : lru;
+    set[idx].valid = TRUE;
+    set[idx].tag = tag;
+    set[idx].lruTime = cpu->clock;
+    return FALSE;
+}
+
+// Returns TRUE when the word at cpu->pc can be fetched this cycle. On an
+// ITLB or L1I miss the fetch is held until the fill latency has elapsed.
+static int fetch_memory_ready(ApexCpu* cpu) {
+    if(cpu->fetchMissPc == cpu->pc) {
+        if(cpu->clock < cpu->fetchReadyCycle) return FALSE;
+        cpu->fetchMissPc = -1;
+        return TRUE;
+    }
+    int latency = 0;
+    if(cpu->config.itlbEntries > 0) {
+        cpu->stats.itlbAccesses++;
+        cpu->stats.accesses[ACC_TLB]++;
+        int vpn = (unsigned int)cpu->pc / cpu->config.pageSize;
+        if(!tlb_access(cpu->itlb, cpu->config.itlbEntries, vpn, cpu->clock)) {
+            cpu->stats.itlbMisses++;
+            latency += cpu->config.itlbMissLatency;
+        }
+    }
+    if(cpu->icacheSets > 0) {
+        cpu->stats.icacheAccesses++;
+        if(!icache_access(cpu, cpu->pc)) {
+            cpu->stats.icacheMisses++;
+            cpu->stats.accesses[ACC_MEM_READ]++;
+            latency += cpu->config.icacheMissLatency;
+        }
+    }
+    if(latency == 0) return TRUE;
+    cpu->pcProfile[code_index(cpu->pc)].fetchMisses++;
+    cpu->fetchMissPc = cpu->pc;
+    cpu->fetchReadyCycle = cpu->clock + latency;
+    return FALSE;
+}
+
+// --------------------------------------------------------------------
+// DATA MEMORY: PAGED VIRTUAL ADDRESS SPACE
+// --------------------------------------------------------------------
+// Finds the host word backing a virtual address. Untouched pages read as
+// zero without being mapped (*word is left NULL); with allocate set a frame
+// is mapped on demand. Returns MEM_OK or the fault that stopped the access.
+static int mem_word(ApexCpu* cpu, unsigned int addr, int allocate, int** word) {
+    *word = NULL;
+    if(cpu->config.memLimit > 0 && addr >= (unsigned int)cpu->config.memLimit) return MEM_FAULT_RANGE;
+    unsigned int vpn = addr >> PAGE_SHIFT;
+    int* leaf = cpu->pageTable[vpn >> PT_LEVEL_BITS];
+    if(!leaf) {
+        if(!allocate) return MEM_OK;
+        leaf = (int*)calloc(PT_ENTRIES, sizeof(int));
+        cpu->pageTable[vpn >> PT_LEVEL_BITS] = leaf;
+    }
+    int* pte = &leaf[vpn & (PT_ENTRIES - 1)];
+    if(*pte == 0) {
+        if(!allocate) return MEM_OK;
+        if(cpu->framesUsed >= cpu->frameCount) return MEM_FAULT_FULL;
+        cpu->frames[cpu->framesUsed] = (int*)calloc(PAGE_WORDS, sizeof(int));
+        *pte = ++cpu->framesUsed;
+        cpu->stats.pagesAllocated++;
+    }
+    *word = &cpu->frames[*pte - 1][addr & (PAGE_WORDS - 1)];
+    return MEM_OK;
+}
+
+static int mem_read(ApexCpu* cpu, unsigned int addr, int* value) {
+    int* word;
+    int status = mem_word(cpu, addr, FALSE, &word);
+    *value = word ? *word : 0;
+    return status;
+}
+
+static int mem_write(ApexCpu* cpu, unsigned int addr, int value) {
+    int* word;
+    int status = mem_word(cpu, addr, TRUE, &word);
+    if(word) *word = value;
+    return status;
+}
+
+// Copies count words to consecutive addresses starting at base, one page
+// at a time. Returns the number of words written before any fault.
+static int mem_write_block(ApexCpu* cpu, unsigned int base, const int* words, int count) {
+    int done = 0;
+    while(done < count) {
+        unsigned int addr = base + done;
+        int chunk = PAGE_WORDS - (addr & (PAGE_WORDS - 1));
+        if(chunk > count - done) chunk = count - done;
+        int* word;
+        if(mem_word(cpu, addr, TRUE, &word) != MEM_OK) break;
+        memcpy(word, words + done, chunk * sizeof(int));
+        done += chunk;
+    }
+    return done;
+}
+
+// --------------------------------------------------------------------
+// STORE BUFFER
+// --------------------------------------------------------------------
+// Entries form a ring over STORE_BUFFER_MAX slots; config.storeBuffer
+// bounds how many are in use. The page of every buffered word is mapped
+// when its store retires, so writing a line back cannot fault.
+
+// Youngest buffered value of addr, if any
+static int sb_lookup(const ApexCpu* cpu, unsigned int addr, int* value) {
+    unsigned int line = addr / SB_LINE_WORDS;
+    int w = addr % SB_LINE_WORDS;
+    for(int k=cpu->sbCount - 1; k>=0; k--) {
+        const StoreBufferEntry* e = &cpu->storeBuffer[(cpu->sbHead + k) % STORE_BUFFER_MAX];
+        if(e->line == line && ((e->mask >> w) & 1)) {
+            *value = e->words[w];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Memory as the program sees it, buffered stores included
+static int mem_read_buffered(ApexCpu* cpu, unsigned int addr, int* value) {
+    if(cpu->sbCount > 0 && sb_lookup(cpu, addr, value)) return MEM_OK;
+    return mem_read(cpu, addr, value);
+}
+
+// The line of addr can take a store: it combines into a buffered line
+// that has not started draining, or a free entry is left
+static int sb_accepts(const ApexCpu* cpu, unsigned int addr) {
+    unsigned int line = addr / SB_LINE_WORDS;
+    for(int k=0; k<cpu->sbCount; k++) {
+        const StoreBufferEntry* e = &cpu->storeBuffer[(cpu->sbHead + k) % STORE_BUFFER_MAX];
+        if(e->line == line && !e->draining) return TRUE;
+    }
+    return cpu->sbCount < cpu->config.storeBuffer;
+}
+
+static void sb_insert(ApexCpu* cpu, unsigned int addr, int value) {
+    unsigned int line = addr / SB_LINE_WORDS;
+    int w = addr % SB_LINE_WORDS;
+    cpu->stats.sbStores++;
+    cpu->stats.accesses[ACC_SB]++;
+    for(int k=0; k<cpu->sbCount; k++) {
+        StoreBufferEntry* e = &cpu->storeBuffer[(cpu->sbHead + k) % STORE_BUFFER_MAX];
+        if(e->line == line && !e->draining) {
+            e->words[w] = value;
+            e->mask |= 1 << w;
+            cpu->stats.sbCombined++;
+            return;
+        }
+    }
+    StoreBufferEntry* e = &cpu->storeBuffer[(cpu->sbHead + cpu->sbCount++) % STORE_BUFFER_MAX];
+    e->line = line;
+    e->mask = 1 << w;
+    e->draining = FALSE;
+    e->allocCycle = cpu->clock;
+    e->words[w] = value;
+}
+
+static void sb_write_line(ApexCpu* cpu, const StoreBufferEntry* e) {
+    cpu->stats.accesses[ACC_SB]++;
+    cpu->stats.accesses[ACC_MEM_WRITE]++;
+    for(int w=0; w<SB_LINE_WORDS; w++) {
+        if((e->mask >> w) & 1) mem_write(cpu, e->line * SB_LINE_WORDS + w, e->words[w]);
+    }
+}
+
+// Writes every buffered line at once, before anything reads or writes
+// memory outside the pipeline
+static void sb_flush(ApexCpu* cpu) {
+    for(int k=0; k<cpu->sbCount; k++) sb_write_line(cpu, &cpu->storeBuffer[(cpu->sbHead + k) % STORE_BUFFER_MAX]);
+    cpu->stats.sbDrains += cpu->sbCount;
+    cpu->sbHead = 0;
+    cpu->sbCount = 0;
+    cpu->sbDrainCycles = 0;
+}
+
+static const char* mem_fault_name(int status) {
+    return (status == MEM_FAULT_RANGE) ? "address beyond mem_limit" : "out of physical memory";
+}
+
+// Frees every in-flight instruction and empties the back end, used when
+// the run stops with work still in the pipeline. Retired stores still
+// buffered are written.
+static void drain_pipeline(ApexCpu* cpu) {
+    sb_flush(cpu);
+    for(int k=0, e=cpu->robHead; k<cpu->robCount; k++, e=(e + 1) % ROB_SIZE) {
+        instr_free(cpu, cpu->rob[e].instr);
+        cpu->rob[e].instr = NULL;
+    }
+    instr_free(cpu, cpu->fetch1Latch); cpu->fetch1Latch = NULL;
+    instr_free(cpu, cpu->fetch2Latch); cpu->fetch2Latch = NULL;
+    instr_free(cpu, cpu->dispatchLatch); cpu->dispatchLatch = NULL;
+    for(int i=0; i<INT_RS_SIZE; i++) { cpu->intRs[i].busy = FALSE; cpu->intRs[i].instr = NULL; }
+    for(int i=0; i<MUL_RS_SIZE; i++) { cpu->mulRs[i].busy = FALSE; cpu->mulRs[i].instr = NULL; }
+    for(int i=0; i<LSQ_SIZE; i++) { cpu->lsq[i].allocated = FALSE; cpu->lsq[i].instr = NULL; }
+    cpu->intFuLatch = NULL;
+    cpu->mulFuLatch = NULL;
+    memset(cpu->mulPipeline, 0, sizeof(cpu->mulPipeline));
+    memset(cpu->mauPipeline, 0, sizeof(cpu->mauPipeline));
+    cpu->robCount = 0; cpu->robHead = 0; cpu->robTail = 0;
+    cpu->lsqCount = 0; cpu->lsqHead = 0; cpu->lsqTail = 0;
+}
+
+// Loads and stores reach the MAU only as the ROB head, so a fault here is
+// precise: everything older has retired and nothing younger has.
+static void memory_fault(ApexCpu* cpu, Instruction* i, int status) {
+    cpu->stats.memFaults++;
+    cpu_log(cpu, APEX_LOG_ERROR, "*** Memory fault: %s at PC %d, address %u (%s) ***\n",
+           i->opcodeStr, i->pc, (unsigned int)i->memoryAddress, mem_fault_name(status));
+    if(cpu->config.memFaultTrap) {
+        cpu->simulationHalted = TRUE;
+        drain_pipeline(cpu);
+    }
+}
+
+// --------------------------------------------------------------------
+// DEBUGGER
+// --------------------------------------------------------------------
+static inline int watch_page_bit(unsigned int addr) {
+    return (addr >> PAGE_SHIFT) & (DEBUG_WATCH_BITS - 1);
+}
+
+static void debug_stop(ApexCpu* cpu, ApexStopReason reason, int pc) {
+    cpu->debug->stop = reason;
+    cpu->debug->stopPc = pc;
+}
+
+// Called as head retires, after the ARF update
+static void debug_commit(ApexCpu* cpu, const RobEntry* head) {
+    ApexDebug* d = cpu->debug;
+    const Instruction* i = head->instr;
+    int idx = code_index(i->pc);
+    int fusedIdx = i->fused ? code_index(i->fusedPc) : -1;
+    if((d->breakMap[idx >> 6] >> (idx & 63)) & 1) {
+        debug_stop(cpu, APEX_STOP_BREAK, i->pc);
+    } else if(fusedIdx >= 0 && ((d->breakMap[fusedIdx >> 6] >> (fusedIdx & 63)) & 1)) {
+        debug_stop(cpu, APEX_STOP_BREAK, i->fusedPc);
+    } else if(d->untilRetired > 0 && cpu->instructionsRetired >= d->untilRetired) {
+        debug_stop(cpu, APEX_STOP_RETIRED, i->pc);
+    } else if(d->condReg != -1 && head->archRd == d->condReg && apex_debug_cond_holds(d, cpu->arf[d->condReg])) {
+        debug_stop(cpu, APEX_STOP_REG, i->pc);
+    }
+}
+
+// Called before a store writes value, so the old value can be reported
+static void debug_store(ApexCpu* cpu, const Instruction* i, int value) {
+    ApexDebug* d = cpu->debug;
+    unsigned int addr = (unsigned int)i->memoryAddress;
+    int bit = watch_page_bit(addr);
+    if(!((d->watchPages[bit >> 6] >> (bit & 63)) & 1)) return;
+    for(int k=0; k<d->watchCount; k++) {
+        if(d->watchAddr[k] != addr) continue;
+        debug_stop(cpu, APEX_STOP_WATCH, i->pc);
+        d->stopAddr = addr;
+        mem_read_buffered(cpu, addr, &d->stopOld);
+        d->stopNew = value;
+        return;
+    }
+}
+
+void cpu_release(ApexCpu* cpu) {
+    drain_pipeline(cpu);
+    while(cpu->instrPoolCount > 0) free(cpu->instrPool[--cpu->instrPoolCount]);
+    cpu->lsd.active = FALSE;
+    for(int i=0; i<CODE_MEMORY_SIZE; i++) {
+        free(cpu->blockCache[i]);
+        cpu->blockCache[i] = NULL;
+    }
+    for(int i=0; i<PT_ENTRIES; i++) {
+        free(cpu->pageTable[i]);
+        cpu->pageTable[i] = NULL;
+    }
+    for(int i=0; i<cpu->framesUsed; i++) free(cpu->frames[i]);
+    free(cpu->frames);
+    cpu->frames = NULL;
+    cpu->frameCount = 0;
+    cpu->framesUsed = 0;
+}
+
+// Extra MAU cycles needed to translate addr: zero on a DTLB hit, otherwise
+// one modeled memory access per page-table level.
+static int dtlb_translate(ApexCpu* cpu, unsigned int addr) {
+    if(cpu->config.dtlbEntries == 0) return 0;
+    cpu->stats.dtlbAccesses++;
+    cpu->stats.accesses[ACC_TLB]++;
+    if(tlb_access(cpu->dtlb, cpu->config.dtlbEntries, addr >> PAGE_SHIFT, cpu->clock)) return 0;
+    cpu->stats.dtlbMisses++;
+    cpu->stats.pageWalks++;
+    cpu->stats.accesses[ACC_MEM_READ] += PT_LEVELS;
+    return PT_LEVELS * cpu->config.ptwLatency;
 }
 
-int ctp_lookup(ApexCpu* cpu, int jalPc) {
+static int ctp_lookup(ApexCpu* cpu, int jalPc) {
+    cpu->stats.accesses[ACC_CTP]++;
     for(int i=0; i<4; i++) {
         if(cpu->ctp[i].valid && cpu->ctp[i].tagPc == jalPc) {
             cpu->ctp[i].lruTime = cpu->clock;
@@ -109,7 +729,8 @@ int ctp_lookup(ApexCpu* cpu, int jalPc) {
     return -1;
 }
 
-void update_ctp(ApexCpu* cpu, int jalPc, int actualTarget) {
+static void update_ctp(ApexCpu* cpu, int jalPc, int actualTarget) {
+    cpu->stats.accesses[ACC_CTP]++;
     int match = -1, lru = -1, empty = -1, minTime = 2147483647;
     for(int i=0; i<4; i++) {
         if(!cpu->ctp[i].valid) {
@@ -126,144 +747,181 @@ void update_ctp(ApexCpu* cpu, int jalPc, int actualTarget) {
     cpu->ctp[idx].lruTime = cpu->clock;
 }
 
-int parse_reg(char* str) {
-    if(!str) return -1;
-    char temp[10]; int j=0;
-    for(int i=0; str[i]; i++) if(str[i] >= '0' && str[i] <= '9') temp[j++] = str[i];
-    temp[j] = '\0';
-    return (j > 0) ? atoi(temp) : -1;
-}
-
-int parse_imm(char* str) {
-    if(!str) return 0;
-    char temp[10]; int j=0;
-    for(int i=0; str[i]; i++) if(str[i] == '-' || (str[i] >= '0' && str[i] <= '9')) temp[j++] = str[i];
-    temp[j] = '\0';
-    return atoi(temp);
-}
-
-Opcode get_opcode_enum(char* str) {
-    if(!strcmp(str, "ADD")) return OP_ADD;
-    if(!strcmp(str, "SUB")) return OP_SUB;
-    if(!strcmp(str, "MUL")) return OP_MUL;
-    if(!strcmp(str, "AND")) return OP_AND;
-    if(!strcmp(str, "OR")) return OP_OR;
-    if(!strcmp(str, "XOR")) return OP_XOR;
-    if(!strcmp(str, "ADDL")) return OP_ADDL;
-    if(!strcmp(str, "SUBL")) return OP_SUBL;
-    if(!strcmp(str, "CML")) return OP_CML;
-    if(!strcmp(str, "CMP")) return OP_CMP;
-    if(!strcmp(str, "LOAD")) return OP_LOAD;
-    if(!strcmp(str, "STORE")) return OP_STORE;
-    if(!strcmp(str, "MOVC")) return OP_MOVC;
-    if(!strcmp(str, "JUMP")) return OP_JUMP;
-    if(!strcmp(str, "JAL")) return OP_JAL;
-    if(!strcmp(str, "RET")) return OP_RET;
-    if(!strcmp(str, "JALP")) return OP_JALP;
-    if(!strcmp(str, "BZ")) return OP_BZ;
-    if(!strcmp(str, "BNZ")) return OP_BNZ;
-    if(!strcmp(str, "BP")) return OP_BP;
-    if(!strcmp(str, "BN")) return OP_BN;
-    if(!strcmp(str, "NOP")) return OP_NOP;
-    if(!strcmp(str, "HALT")) return OP_HALT;
-    return OP_INVALID;
-}
-
-void cpu_load_program(ApexCpu* cpu, const char* filename) {
-    FILE* fp = fopen(filename, "r");
-    if(!fp) { printf("Error opening file %s\n", filename); return; }
-    char line[128]; int loadAddr = 4000;
-    while(fgets(line, sizeof(line), fp)) {
-        char* comment = strchr(line, '/'); if(comment) *comment = '\0';
-        char* newline = strchr(line, '\n'); if(newline) *newline = '\0';
-        if(strlen(line) < 2) continue;
-        char* parts[4]; int partCount = 0;
-        char* token = strtok(line, ", \t");
-        while(token) { parts[partCount++] = token; token = strtok(NULL, ", \t"); }
-        if(partCount == 0) continue;
-        Instruction instr; memset(&instr, 0, sizeof(Instruction));
-        instr.opcode = get_opcode_enum(parts[0]);
-        strcpy(instr.opcodeStr, parts[0]);
-        instr.pc = loadAddr;
-        instr.rd = -1; instr.rs1 = -1; instr.rs2 = -1;
-        switch(instr.opcode) {
-            case OP_ADD: case OP_SUB: case OP_MUL: case OP_AND: case OP_OR: case OP_XOR:
-                instr.rd = parse_reg(parts[1]); instr.rs1 = parse_reg(parts[2]); instr.rs2 = parse_reg(parts[3]); break;
-            case OP_ADDL: case OP_SUBL:
-                instr.rd = parse_reg(parts[1]); instr.rs1 = parse_reg(parts[2]); instr.imm = parse_imm(parts[3]); break;
-            case OP_LOAD:
-                instr.rd = parse_reg(parts[1]); instr.rs1 = parse_reg(parts[2]); instr.imm = parse_imm(parts[3]); break;
-            case OP_STORE:
-                instr.rs1 = parse_reg(parts[1]); instr.rs2 = parse_reg(parts[2]); instr.imm = parse_imm(parts[3]); break;
-            case OP_MOVC:
-                instr.rd = parse_reg(parts[1]); instr.imm = parse_imm(parts[2]); break;
-            case OP_CMP:
-                instr.rs1 = parse_reg(parts[1]); instr.rs2 = parse_reg(parts[2]); break;
-            case OP_CML:
-                instr.rs1 = parse_reg(parts[1]); instr.imm = parse_imm(parts[2]); break;
-            case OP_BZ: case OP_BNZ: case OP_BP: case OP_BN:
-                instr.imm = parse_imm(parts[1]); break;
-            case OP_JUMP:
-                instr.rs1 = parse_reg(parts[1]); instr.imm = parse_imm(parts[2]); break;
-            case OP_JAL: case OP_JALP:
-                instr.rd = parse_reg(parts[1]); instr.imm = parse_imm(parts[2]); break;
-            case OP_RET:
-                instr.rs1 = parse_reg(parts[1]); break;
-            default: break;
-        }
-        instr.physRd = -1; instr.physRs1 = -1; instr.physRs2 = -1; 
-        instr.physCc = -1; instr.physSrcCc = -1;
-        instr.robIndex = -1; instr.lsqIndex = -1; instr.bisIndex = -1;
-        cpu->codeMemory[(loadAddr - 4000) / 4] = instr;
-        loadAddr += 4;
-    }
-    fclose(fp);
+// Maps a file read-only. Returns NULL if the file cannot be opened; an empty
+// file maps to an empty buffer with *size 0. Release with unmap_file.
+static void* map_file(const char* path, size_t* size) {
+    static char empty;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat st;
+    void* data = NULL;
+    if(fstat(fd, &st) == 0) {
+        *size = st.st_size;
+        if(st.st_size == 0) data = &empty;
+        else {
+            data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data == MAP_FAILED) data = NULL;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+static void unmap_file(void* data, size_t size) {
+    if(size > 0) munmap(data, size);
+}
+
+// Assembles a program (apex_asm.h) and installs it. Code memory is only
+// replaced if the whole program assembles; a .word that faults is reported
+// and fails the load.
+static int load_program(ApexCpu* cpu, const char* file, const char* text, size_t length) {
+    ApexAsmImage image;
+    int loaded = apex_asm_assemble(cpu, file, text, length, &image);
+    if(loaded < 0) return -1;
+    memcpy(cpu->codeMemory, image.code, sizeof(cpu->codeMemory));
+    memcpy(cpu->codeSourceLine, image.sourceLine, sizeof(cpu->codeSourceLine));
+    cpu->codeVersion++;
+    for(int k=0; k<image.dataCount; k+=2) {
+        int status = mem_write(cpu, image.data[k], (int)image.data[k + 1]);
+        if(status != MEM_OK) {
+            cpu_log(cpu, APEX_LOG_ERROR, "%s: error: .word at %u: %s\n", file, image.data[k], mem_fault_name(status));
+            loaded = -1;
+            break;
+        }
+    }
+    apex_asm_release(&image);
+    return loaded;
+}
+
+// Assembles program text held in memory. Returns the number of
+// instructions loaded, or -1 after logging errors.
+int cpu_load_program_text(ApexCpu* cpu, const char* text, size_t length) {
+    return load_program(cpu, "program", text, length);
+}
+
+int cpu_load_program(ApexCpu* cpu, const char* filename) {
+    size_t size;
+    char* text = (char*)map_file(filename, &size);
+    if(!text) { cpu_log(cpu, APEX_LOG_ERROR, "Error opening file %s\n", filename); return -1; }
+    int loaded = load_program(cpu, filename, text, size);
+    unmap_file(text, size);
+    return loaded;
 }
 
 void cpu_set_memory(ApexCpu* cpu, int address, int value) {
-    if(address >= 0 && address < DATA_MEMORY_SIZE) {
-        cpu->dataMemory[address] = value;
-        printf("Memory[%d] set to %d\n", address, value);
+    sb_flush(cpu);
+    int status = mem_write(cpu, (unsigned int)address, value);
+    if(status == MEM_OK) cpu_log(cpu, APEX_LOG_INFO, "Memory[%d] set to %d\n", address, value);
+    else cpu_log(cpu, APEX_LOG_ERROR, "Error: Memory[%d] not set (%s)\n", address, mem_fault_name(status));
+}
+
+// Binary image: raw host-endian 32-bit words stored from word address base.
+int cpu_load_memory_image(ApexCpu* cpu, const char* path, unsigned int base) {
+    size_t size;
+    int* words = (int*)map_file(path, &size);
+    if(!words) return -1;
+    int count = (int)(size / sizeof(int));
+    sb_flush(cpu);
+    int loaded = mem_write_block(cpu, base, words, count);
+    unmap_file(words, size);
+    if(loaded < count) cpu_log(cpu, APEX_LOG_ERROR, "Error: image %s truncated at word %d\n", path, loaded);
+    return loaded;
+}
+
+// Text image: whitespace-separated decimal words stored from word address base.
+// Loading stops at the first token that is not a decimal int; the words
+// before it are stored and counted.
+int cpu_load_memory_text(ApexCpu* cpu, const char* path, unsigned int base) {
+    size_t size;
+    char* text = (char*)map_file(path, &size);
+    if(!text) return -1;
+    sb_flush(cpu);
+    int buffer[PAGE_WORDS];
+    int buffered = 0, loaded = 0, ok = TRUE;
+    const char* p = text;
+    const char* end = text + size;
+    while(ok) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if(p == end) break;
+        const char* token = p;
+        int negative = (*p == '-');
+        if(negative || *p == '+') p++;
+        long long value = 0;
+        const char* digits = p;
+        while(p < end && *p >= '0' && *p <= '9' && value <= INT_MAX) value = value * 10 + (*p++ - '0');
+        int separated = (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n');
+        if(p == digits || !separated || value > (negative ? -(long long)INT_MIN : INT_MAX)) {
+            cpu_log(cpu, APEX_LOG_ERROR, "Error: %s: bad word at offset %ld\n", path, (long)(token - text));
+            ok = FALSE;
+            break;
+        }
+        buffer[buffered++] = (int)(negative ? -value : value);
+        if(buffered == PAGE_WORDS) {
+            int written = mem_write_block(cpu, base + loaded, buffer, buffered);
+            loaded += written;
+            ok = (written == buffered);
+            buffered = 0;
+        }
     }
+    // Words before a bad token are kept, as the old line-by-line loader did
+    if(buffered > 0) loaded += mem_write_block(cpu, base + loaded, buffer, buffered);
+    unmap_file(text, size);
+    return loaded;
 }
 
-int sets_flags(Opcode op) {
+static int sets_flags(Opcode op) {
     return (op == OP_ADD || op == OP_SUB || op == OP_AND || op == OP_MUL || 
             op == OP_ADDL || op == OP_SUBL || op == OP_CMP || op == OP_CML);
 }
-int is_branch(Instruction* i) {
+static int is_branch(const Instruction* i) {
     return (i->opcode == OP_BZ || i->opcode == OP_BNZ || i->opcode == OP_BP || i->opcode == OP_BN ||
             i->opcode == OP_JAL || i->opcode == OP_JALP || i->opcode == OP_RET);
 }
-int needs_flags(Opcode op) {
+static int needs_flags(Opcode op) {
     return (op == OP_BZ || op == OP_BNZ || op == OP_BP || op == OP_BN);
 }
+static int writes_flags(const Instruction* i) {
+    return sets_flags(i->opcode) || i->fused;
+}
+
+// Records that source s of a waiting instruction arrived by broadcast now
+static inline void wake_source(ApexCpu* cpu, Instruction* instr, int s, int cluster) {
+    instr->wokenMask |= 1 << s;
+    if(cluster == CLUSTER_MUL) instr->wokenFromMul |= 1 << s;
+    instr->wakeCycle[s] = cpu->clock;
+}
 
-void update_rs_flags(ApexCpu* cpu, int tag, int val) {
+// Every busy entry compares the broadcast tag against its sources
+static void update_rs_flags(ApexCpu* cpu, int tag, int val, int cluster) {
     for(int i=0; i<INT_RS_SIZE; i++) {
+        cpu->stats.accesses[ACC_RS_COMPARE] += cpu->intRs[i].busy;
         if(cpu->intRs[i].busy && !cpu->intRs[i].instr->flagsReady && cpu->intRs[i].instr->physSrcCc == tag) {
             cpu->intRs[i].instr->flagsValue = val;
             cpu->intRs[i].instr->flagsReady = TRUE;
+            wake_source(cpu, cpu->intRs[i].instr, 2, cluster);
         }
     }
 }
-void update_rs_operands(ApexCpu* cpu, int tag, int val) {
+static void update_rs_operands(ApexCpu* cpu, int tag, int val, int cluster) {
     for(int i=0; i<INT_RS_SIZE;i++) {
         if(cpu->intRs[i].busy){
             Instruction* instr = cpu->intRs[i].instr;
-            if(!instr->rs1Ready && instr->physRs1 == tag) { instr->rs1Value = val; instr->rs1Ready = TRUE; }
-            if(!instr->rs2Ready && instr->physRs2 == tag) { instr->rs2Value = val; instr->rs2Ready = TRUE; }
+            cpu->stats.accesses[ACC_RS_COMPARE] += 2;
+            if(!instr->rs1Ready && instr->physRs1 == tag) { instr->rs1Value = val; instr->rs1Ready = TRUE; wake_source(cpu, instr, 0, cluster); }
+            if(!instr->rs2Ready && instr->physRs2 == tag) { instr->rs2Value = val; instr->rs2Ready = TRUE; wake_source(cpu, instr, 1, cluster); }
         }
     }
     for(int i=0; i<MUL_RS_SIZE;i++){
         if(cpu->mulRs[i].busy) {
             Instruction* instr = cpu->mulRs[i].instr;
-            if(!instr->rs1Ready && instr->physRs1 == tag) { instr->rs1Value = val; instr->rs1Ready = TRUE; }
-            if(!instr->rs2Ready && instr->physRs2 == tag) { instr->rs2Value = val; instr->rs2Ready = TRUE; }
+            cpu->stats.accesses[ACC_RS_COMPARE] += 2;
+            if(!instr->rs1Ready && instr->physRs1 == tag) { instr->rs1Value = val; instr->rs1Ready = TRUE; wake_source(cpu, instr, 0, cluster); }
+            if(!instr->rs2Ready && instr->physRs2 == tag) { instr->rs2Value = val; instr->rs2Ready = TRUE; wake_source(cpu, instr, 1, cluster); }
         }
     }
 }
-void update_lsq_data(ApexCpu* cpu, int tag, int val) {
+static void update_lsq_data(ApexCpu* cpu, int tag, int val) {
+    cpu->stats.accesses[ACC_LSQ_SEARCH]++;
     for(int i=0; i<LSQ_SIZE; i++) {
         if(cpu->lsq[i].allocated && cpu->lsq[i].instr->opcode == OP_STORE && !cpu->lsq[i].dataValid) {
             if(cpu->lsq[i].instr->physRs1== tag) {
@@ -274,63 +932,228 @@ void update_lsq_data(ApexCpu* cpu, int tag, int val) {
     }
 }
 
-void data_forwarding(ApexCpu* cpu) {
+// Broadcasts last cycle's results. With limited PRF write ports, results
+// beyond the port count stay in the buffer, oldest first, for next cycle.
+static ALWAYS_INLINE void data_forwarding(ApexCpu* cpu, KernelSpec spec) {
+    int writes = 0, held = 0;
     for(int i=0; i<cpu->forwardingCount; i++) {
         ForwardingData data = cpu->forwardingBuffer[i];
         if(data.isCc) {
-            cpu->cprf[data.physRegTag].value= data.value;
-            cpu->cprf[data.physRegTag].valid =TRUE;
-            update_rs_flags(cpu, data.physRegTag, data.value);
+            cpu->cprfValue[data.physRegTag] = data.value;
+            bitmap_set(&cpu->cprfValid, data.physRegTag);
+            cpu->stats.accesses[ACC_CPRF_WRITE]++;
+            update_rs_flags(cpu, data.physRegTag, data.value, data.cluster);
         } else {
-            cpu->prf[data.physRegTag].value =data.value;
-            cpu->prf[data.physRegTag].valid=TRUE;
-            update_rs_operands(cpu, data.physRegTag, data.value);
+            if(spec.extras && cpu->config.prfWritePorts > 0 && writes == cpu->config.prfWritePorts) {
+                cpu->forwardingBuffer[held++] = data;
+                cpu->stats.deferredWrites++;
+                continue;
+            }
+            writes++;
+            cpu->prfValue[data.physRegTag] = data.value;
+            bitmap_set(&cpu->prfValid, data.physRegTag);
+            cpu->stats.accesses[ACC_PRF_WRITE]++;
+            update_rs_operands(cpu, data.physRegTag, data.value, data.cluster);
             update_lsq_data(cpu, data.physRegTag, data.value);
         }
         for(int r=0; r<ROB_SIZE; r++) {
             RobEntry* entry = &cpu->rob[r];
             if(entry->status == 0 && entry->instr) {
-                if(data.isCc && entry->physCc==data.physRegTag) entry->status = 1;
-                if(!data.isCc && entry->physRd== data.physRegTag) entry->status = 1;
+                if((data.isCc && entry->physCc == data.physRegTag) || (!data.isCc && entry->physRd == data.physRegTag)) {
+                    entry->status = 1;
+                    cpu->stats.accesses[ACC_ROB_WRITE]++;
+                }
             }
         }
     }
-    cpu->forwardingCount = 0;
+    cpu->forwardingCount = held;
+}
+
+// A result still waiting for a write port has not reached the PRF
+static int result_held(const ApexCpu* cpu, int physRd) {
+    for(int k=0; k<cpu->forwardingCount; k++) {
+        if(!cpu->forwardingBuffer[k].isCc && cpu->forwardingBuffer[k].physRegTag == physRd) return TRUE;
+    }
+    return FALSE;
+}
+
+// A register freed at commit must stay free if an in-flight branch later
+// restores its checkpoint, so it is added to every live free-list snapshot.
+static void release_to_snapshots(ApexCpu* cpu, int reg, int isCc) {
+    if(cpu->config.robWalk) return;
+    for(int k=0, b=cpu->bisHead; k<cpu->bisCount; k++, b=(b+1)%BIS_SIZE) {
+        bitmap_set(isCc ? &cpu->bis[b].freeListCcSnapshot : &cpu->bis[b].freeListSnapshot, reg);
+    }
 }
 
-void commitRob(ApexCpu* cpu) {
+// --------------------------------------------------------------------
+// VALUE PREDICTION
+// --------------------------------------------------------------------
+// Loads and MULs are the long-latency producers worth predicting
+static int value_predictable(const Instruction* i) {
+    return (i->opcode == OP_LOAD || i->opcode == OP_MUL) && i->physRd != -1;
+}
+
+static ValuePredEntry* vp_entry(ApexCpu* cpu, int pc) {
+    return &cpu->valuePred[code_index(pc) & (cpu->config.vpEntries - 1)];
+}
+
+// At dispatch: once confident, write the predicted result into the
+// destination and mark it ready, so consumers issue without waiting.
+static void vp_dispatch(ApexCpu* cpu, Instruction* i) {
+    if(cpu->config.valuePred == VP_OFF || !value_predictable(i)) return;
+    ValuePredEntry* e = vp_entry(cpu, i->pc);
+    cpu->stats.accesses[ACC_VP]++;
+    if(e->tagPc != i->pc) {
+        memset(e, 0, sizeof(ValuePredEntry));
+        e->tagPc = i->pc;
+        return;
+    }
+    i->valueTracked = TRUE;
+    e->inflight++;
+    if(e->confidence < cpu->config.vpThreshold) return;
+    // Older instances still in flight have not trained the entry yet
+    i->predictedValue = e->lastValue;
+    if(cpu->config.valuePred == VP_STRIDE) i->predictedValue += e->stride * e->inflight;
+    i->valuePredicted = TRUE;
+    cpu->prfValue[i->physRd] = i->predictedValue;
+    bitmap_set(&cpu->prfValid, i->physRd);
+}
+
+// Drops a squashed or retired instance from its entry's in-flight count
+static void vp_release(ApexCpu* cpu, Instruction* i) {
+    if(!i->valueTracked) return;
+    ValuePredEntry* e = vp_entry(cpu, i->pc);
+    if(e->tagPc == i->pc && e->inflight > 0) e->inflight--;
+    i->valueTracked = FALSE;
+}
+
+// Trains in commit order, so lastValue is always the previous instance
+static void vp_commit(ApexCpu* cpu, Instruction* i) {
+    if(cpu->config.valuePred == VP_OFF || !value_predictable(i)) return;
+    int value = cpu->prfValue[i->physRd];
+    cpu->stats.vpEligible++;
+    if(i->valuePredicted) {
+        cpu->stats.vpPredicted++;
+        if(i->predictedValue == value) cpu->stats.vpCorrect++;
+    }
+    vp_release(cpu, i);
+    ValuePredEntry* e = vp_entry(cpu, i->pc);
+    cpu->stats.accesses[ACC_VP]++;
+    if(e->tagPc != i->pc) return;
+    int stride = (cpu->config.valuePred == VP_STRIDE) ? value - e->lastValue : 0;
+    if(stride == e->stride && value == e->lastValue + e->stride) {
+        if(e->confidence < VP_MAX_CONFIDENCE) e->confidence++;
+    } else {
+        e->confidence = 0;
+    }
+    e->stride = stride;
+    e->lastValue = value;
+}
+
+// Child of the current call path for a call to entryPc, created on first
+// use. Once the frame table is full, deeper calls stay in the caller.
+static int profile_frame(ApexCpu* cpu, int entryPc) {
+    for(int f=1; f<cpu->profFrameCount; f++) {
+        if(cpu->profFrames[f].parent == cpu->profFrame && cpu->profFrames[f].entryPc == entryPc) return f;
+    }
+    if(cpu->profFrameCount == PROFILE_MAX_FRAMES) return cpu->profFrame;
+    ProfileFrame* f = &cpu->profFrames[cpu->profFrameCount];
+    f->parent = cpu->profFrame;
+    f->entryPc = entryPc;
+    f->cycles = 0;
+    return cpu->profFrameCount++;
+}
+
+static void profile_commit(ApexCpu* cpu, Instruction* i) {
+    PcProfile* p = &cpu->pcProfile[code_index(i->pc)];
+    p->executed++;
+    p->inflightCycles += cpu->clock - i->dispatchCycle;
+    if(i->fused) {
+        PcProfile* head = &cpu->pcProfile[code_index(i->fusedPc)];
+        head->executed++;
+        head->inflightCycles += cpu->clock - i->dispatchCycle;
+    }
+    if(i->opcode == OP_JAL || i->opcode == OP_JALP) cpu->profFrame = profile_frame(cpu, i->memoryAddress);
+    else if(i->opcode == OP_RET && cpu->profFrame != 0) cpu->profFrame = cpu->profFrames[cpu->profFrame].parent;
+}
+
+// With a store buffer a store completes as the ROB head as soon as its
+// address and data are known: the write is queued and retires with it.
+// Its page is mapped here, so a fault is still precise.
+static void store_retire(ApexCpu* cpu, RobEntry* head) {
+    LsqEntry* e = &cpu->lsq[head->lsqIndex];
+    if(!e->addressValid || !e->dataValid) return;
+    unsigned int addr = (unsigned int)e->memAddress;
+    if(!sb_accepts(cpu, addr)) {
+        cpu->stats.sbFullCycles++;
+        return;
+    }
+    int* word;
+    int status = mem_word(cpu, addr, TRUE, &word);
+    if(status != MEM_OK) {
+        memory_fault(cpu, head->instr, status);
+        if(cpu->simulationHalted) return;
+    } else {
+        if(cpu->debug && cpu->debug->watchCount) debug_store(cpu, head->instr, e->storeData);
+        sb_insert(cpu, addr, e->storeData);
+    }
+    e->allocated = FALSE;
+    cpu->lsqHead = (cpu->lsqHead + 1) % LSQ_SIZE;
+    cpu->lsqCount--;
+    head->status = 1;
+}
+
+static ALWAYS_INLINE void commitRob(ApexCpu* cpu, KernelSpec spec) {
+    cpu->profFrames[cpu->profFrame].cycles++;
     if(cpu->robCount == 0) return;
     RobEntry* head = &cpu->rob[cpu->robHead];
+    if(head->status == 1 && spec.extras && cpu->forwardingCount > 0 && head->archRd != -1 && result_held(cpu, head->physRd)) return;
+    if(spec.extras && cpu->config.storeBuffer > 0 && head->status != 1 && head->instr->opcode == OP_STORE) {
+        store_retire(cpu, head);
+        if(cpu->simulationHalted) return;
+    }
+    if(head->status != 1) cpu->pcProfile[code_index(head->instr->pc)].headCycles++;
     if(head->status == 1){
-        // printf("  [COMMIT] %s\n", head->instr->opcodeStr); // Minimal log
-        
         if(head->instr->opcode == OP_HALT){
             cpu->simulationHalted = TRUE;
-            printf("Simulation Halted by HALT instruction.\n");
-            cpu->robCount = 0; cpu->robHead = 0; cpu->robTail = 0;
+            cpu_log(cpu, APEX_LOG_INFO, "Simulation Halted by HALT instruction.\n");
+            drain_pipeline(cpu);
             return;
         }
+        cpu->stats.accesses[ACC_ROB_READ]++;
         if(head->archRd != -1) {
-            cpu->arf[head->archRd] = cpu->prf[head->physRd].value;
+            cpu->arf[head->archRd] = cpu->prfValue[head->physRd];
+            cpu->stats.accesses[ACC_PRF_READ]++;
+            cpu->stats.accesses[ACC_ARF_WRITE]++;
             if(head->oldPhysRd != -1) {
-                cpu->prf[head->oldPhysRd].allocated = FALSE;
-                cpu->prf[head->oldPhysRd].valid = FALSE;
-                queue_enqueue(&cpu->freeListPrf, head->oldPhysRd);
+                bitmap_clear(&cpu->prfValid, head->oldPhysRd);
+                bitmap_set(&cpu->freeListPrf, head->oldPhysRd);
+                release_to_snapshots(cpu, head->oldPhysRd, FALSE);
             }
         }
         if(head->writesCc) {
             if(head->oldPhysCc != -1) {
-                cpu->cprf[head->oldPhysCc].allocated = FALSE;
-                cpu->cprf[head->oldPhysCc].valid = FALSE;
-                queue_enqueue(&cpu->freeListCprf, head->oldPhysCc);
+                bitmap_clear(&cpu->cprfValid, head->oldPhysCc);
+                bitmap_set(&cpu->freeListCprf, head->oldPhysCc);
+                release_to_snapshots(cpu, head->oldPhysCc, TRUE);
             }
         }
         if(head->isBranch){
             cpu->bisHead = (cpu->bisHead +1)% BIS_SIZE;
             cpu->bisCount--;
+            cpu->stats.branches++;
         }
         cpu->instructionsRetired++;
-        if(head->instr) free(head->instr);
+        if(head->instr->fused) {
+            cpu->instructionsRetired++;
+            cpu->stats.fusedPairs++;
+        }
+        if(spec.extras) vp_commit(cpu, head->instr);
+        profile_commit(cpu, head->instr);
+        if(cpu->debug && cpu->debug->commitChecks) debug_commit(cpu, head);
+        cpu_hook(cpu, APEX_HOOK_COMMIT, head->instr);
+        instr_free(cpu, head->instr);
         memset(head, 0, sizeof(RobEntry));
         head->archRd = -1; head->physRd = -1; head->oldPhysRd = -1;
         head->physCc = -1; head->oldPhysCc = -1;
@@ -339,39 +1162,72 @@ void commitRob(ApexCpu* cpu) {
     }
 }
 
-int is_rob_index_valid(ApexCpu* cpu, int idx) {
-    if(cpu->robCount == 0) return FALSE;
-    if(cpu->robHead < cpu->robTail) return (idx >= cpu->robHead && idx < cpu->robTail);
-    else return (idx >= cpu->robHead || idx < cpu->robTail);
+static long long squash_instruction(ApexCpu* cpu, Instruction* instr) {
+    long long wasted = cpu->clock - instr->fetchCycle;
+    vp_release(cpu, instr);
+    instr_free(cpu, instr);
+    return wasted;
 }
 
-void flush_invalid_instructions(ApexCpu* cpu) {
-    for(int i=0; i<INT_RS_SIZE; i++) {
-        if(cpu->intRs[i].busy && !is_rob_index_valid(cpu, cpu->intRs[i].instr->robIndex)) {
-            cpu->intRs[i].busy = FALSE; cpu->intRs[i].instr = NULL;
-        }
+// Squashes everything dispatched after i, plus the front-end latches.
+// Younger work is a suffix of the ROB and LSQ, so both are cut back from
+// the tail; reservation stations and pipelines drop by age. Must run
+// before the ROB tail is moved back to i. A mispredicted branch is
+// charged with the squashed work in blame.
+static void squash_younger(ApexCpu* cpu, Instruction* i, BranchStats* blame) {
+    int seq = i->seq;
+    for(int k=0; k<INT_RS_SIZE; k++) {
+        if(cpu->intRs[k].busy && cpu->intRs[k].instr->seq > seq) { cpu->intRs[k].busy = FALSE; cpu->intRs[k].instr = NULL; }
     }
-    for(int i=0; i<MUL_RS_SIZE; i++) {
-        if(cpu->mulRs[i].busy && !is_rob_index_valid(cpu, cpu->mulRs[i].instr->robIndex)) {
-            cpu->mulRs[i].busy = FALSE; cpu->mulRs[i].instr = NULL;
-        }
+    for(int k=0; k<MUL_RS_SIZE; k++) {
+        if(cpu->mulRs[k].busy && cpu->mulRs[k].instr->seq > seq) { cpu->mulRs[k].busy = FALSE; cpu->mulRs[k].instr = NULL; }
     }
-    for(int i=0; i<LSQ_SIZE; i++) {
-        if(cpu->lsq[i].allocated && !is_rob_index_valid(cpu, cpu->lsq[i].instr->robIndex)) {
-            cpu->lsq[i].allocated = FALSE; cpu->lsq[i].instr = NULL;
-        }
+    while(cpu->lsqCount > 0) {
+        int t = (cpu->lsqTail + LSQ_SIZE - 1) % LSQ_SIZE;
+        if(cpu->lsq[t].instr->seq <= seq) break;
+        cpu->lsq[t].allocated = FALSE; cpu->lsq[t].instr = NULL;
+        cpu->lsqTail = t;
+        cpu->lsqCount--;
     }
-    if(cpu->intFuLatch && !is_rob_index_valid(cpu, cpu->intFuLatch->robIndex)) cpu->intFuLatch = NULL;
-    if(cpu->mulFuLatch && !is_rob_index_valid(cpu, cpu->mulFuLatch->robIndex)) cpu->mulFuLatch = NULL;
-    for(int i=0; i<3; i++) {
-        if(cpu->mulPipeline[i] && !is_rob_index_valid(cpu, cpu->mulPipeline[i]->robIndex)) cpu->mulPipeline[i] = NULL;
+    if(cpu->intFuLatch && cpu->intFuLatch->seq > seq) cpu->intFuLatch = NULL;
+    if(cpu->mulFuLatch && cpu->mulFuLatch->seq > seq) cpu->mulFuLatch = NULL;
+    for(int k=0; k<3; k++) {
+        if(cpu->mulPipeline[k] && cpu->mulPipeline[k]->seq > seq) cpu->mulPipeline[k] = NULL;
     }
-    for(int i=0; i<2; i++) {
-        if(cpu->mauPipeline[i] && !is_rob_index_valid(cpu, cpu->mauPipeline[i]->robIndex)) cpu->mauPipeline[i] = NULL;
+    for(int k=0; k<2; k++) {
+        if(cpu->mauPipeline[k] && cpu->mauPipeline[k]->seq > seq) cpu->mauPipeline[k] = NULL;
+    }
+    
+    // Nothing references the squashed instructions any more
+    long long squashed = 0, wasted = 0;
+    for(int e=(i->robIndex + 1) % ROB_SIZE; e != cpu->robTail; e=(e + 1) % ROB_SIZE) {
+        wasted += squash_instruction(cpu, cpu->rob[e].instr);
+        cpu->rob[e].instr = NULL;
+        squashed++;
+    }
+    Instruction** frontEnd[3] = {&cpu->fetch1Latch, &cpu->fetch2Latch, &cpu->dispatchLatch};
+    for(int k=0; k<3; k++) {
+        if(*frontEnd[k]) { wasted += squash_instruction(cpu, *frontEnd[k]); *frontEnd[k] = NULL; squashed++; }
+    }
+    
+    int f = 0;
+    for(int k=0; k<cpu->forwardingCount; k++) {
+        if(cpu->forwardingBuffer[k].seq <= seq) cpu->forwardingBuffer[f++] = cpu->forwardingBuffer[k];
+    }
+    cpu->forwardingCount = f;
+    
+    cpu->stats.squashedInstructions += squashed;
+    cpu->stats.wastedCycles += wasted;
+    if(blame) {
+        cpu->stats.branchMispredicts++;
+        blame->mispredicts++;
+        blame->squashed += squashed;
+        blame->wastedCycles += wasted;
     }
 }
 
-void update_btb(ApexCpu* cpu, int pcTag, int target, int taken) {
+static void update_btb(ApexCpu* cpu, int pcTag, int target, int taken) {
+    cpu->stats.accesses[ACC_BTB]++;
     int match = -1, lru = -1, empty = -1, minTime = 2147483647;
     for(int i=0; i<8; i++) {
         if(!cpu->btb[i].valid) { if(empty == -1) empty = i; }
@@ -389,24 +1245,76 @@ void update_btb(ApexCpu* cpu, int pcTag, int target, int taken) {
     else { if(cpu->btb[idx].history > 0) cpu->btb[idx].history--; }
 }
 
-void handle_misprediction(ApexCpu* cpu, Instruction* i) {
+// Undoes the renames of everything younger than the branch, youngest
+// first, and returns their registers (and those of the instruction waiting
+// in dispatch) to the free lists.
+static void rob_walk_recover(ApexCpu* cpu, int younger) {
+    int e = cpu->robTail;
+    for(int k=0; k<younger; k++) {
+        e = (e + ROB_SIZE - 1) % ROB_SIZE;
+        RobEntry* r = &cpu->rob[e];
+        cpu->stats.accesses[ACC_ROB_READ]++;
+        cpu->stats.accesses[ACC_RAT_WRITE] += (r->archRd != -1) + r->writesCc;
+        if(r->archRd != -1) {
+            cpu->rat[r->archRd] = r->oldPhysRd;
+            bitmap_set(&cpu->freeListPrf, r->physRd);
+        }
+        if(r->writesCc) {
+            cpu->ratCc = r->oldPhysCc;
+            bitmap_set(&cpu->freeListCprf, r->physCc);
+        }
+    }
+    Instruction* d = cpu->dispatchLatch;
+    if(d && d->physRd != -1) bitmap_set(&cpu->freeListPrf, d->physRd);
+    if(d && d->physCc != -1) bitmap_set(&cpu->freeListCprf, d->physCc);
+}
+
+static long long host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Rolls rename state back to just after i and squashes everything younger;
+// the caller redirects fetch. A branch restores its checkpoint unless
+// recovery walks the ROB; anything else has no checkpoint and always walks.
+static void flush_after(ApexCpu* cpu, Instruction* i, BranchStats* blame) {
     cpu->wasFlushed = TRUE;
-    BisEntry* snap = &cpu->bis[i->bisIndex];
-    memcpy(cpu->rat, snap->ratSnapshot, sizeof(cpu->rat));
-    cpu->ratCc = snap->ratCcSnapshot;
-    cpu->freeListPrf = snap->freeListSnapshot;
-    cpu->freeListCprf = snap->freeListCcSnapshot;
-    cpu->robTail = (snap->robTailSnapshot + 1) % ROB_SIZE;
-    if (cpu->robTail >= cpu->robHead) cpu->robCount = cpu->robTail - cpu->robHead;
-    else cpu->robCount = ROB_SIZE - (cpu->robHead - cpu->robTail);
-    
-    if(cpu->fetch1Latch) free(cpu->fetch1Latch); cpu->fetch1Latch= NULL;
-    if(cpu->fetch2Latch) free(cpu->fetch2Latch); cpu->fetch2Latch =NULL;
-    if(cpu->dispatchLatch) free(cpu->dispatchLatch); cpu->dispatchLatch= NULL;
-    
-    cpu->forwardingCount = 0; 
-    flush_invalid_instructions(cpu);
-    
+    cpu_hook(cpu, APEX_HOOK_FLUSH, i);
+    long long start = host_ns();
+    int age = (i->robIndex - cpu->robHead + ROB_SIZE) % ROB_SIZE;
+    int younger = cpu->robCount - age - 1;
+    int youngerBranches = 0;
+    for(int k=1; k<=younger; k++) youngerBranches += cpu->rob[(i->robIndex + k) % ROB_SIZE].isBranch;
+    if(cpu->config.robWalk || i->bisIndex == -1) {
+        rob_walk_recover(cpu, younger);
+        int cycles = (younger + cpu->config.robWalkWidth - 1) / cpu->config.robWalkWidth;
+        if(cycles > 0) cpu->renameResumeCycle = cpu->clock + 1 + cycles;
+        cpu->stats.recoveryCycles += cycles;
+        cpu->stats.recoveryWalkEntries += younger;
+    } else {
+        BisEntry* snap = &cpu->bis[i->bisIndex];
+        memcpy(cpu->rat, snap->ratSnapshot, sizeof(cpu->rat));
+        cpu->ratCc = snap->ratCcSnapshot;
+        cpu->freeListPrf = snap->freeListSnapshot;
+        cpu->freeListCprf = snap->freeListCcSnapshot;
+        cpu->stats.accesses[ACC_CHECKPOINT]++;
+    }
+    cpu->stats.recoveries++;
+    squash_younger(cpu, i, blame);
+    cpu->robTail = (i->robIndex + 1) % ROB_SIZE;
+    cpu->robCount = age + 1;
+    cpu->bisTail = (cpu->bisTail + BIS_SIZE - youngerBranches) % BIS_SIZE;
+    cpu->bisCount -= youngerBranches;
+    cpu->fetchStalled = FALSE;      // a squashed JUMP can no longer release fetch
+    cpu->lsd.active = FALSE;
+    cpu->lsd.trips = 0;
+    cpu->stats.recoveryHostNs += host_ns() - start;
+    if(cpu->config.redirectPenalty > 0) cpu->redirectReadyCycle = cpu->clock + cpu->config.redirectPenalty;
+}
+
+static void handle_misprediction(ApexCpu* cpu, Instruction* i) {
+    flush_after(cpu, i, &cpu->branchStats[code_index(i->pc)]);
     if(i->opcode== OP_BZ || i->opcode ==OP_BNZ || i->opcode ==OP_BP || i->opcode ==OP_BN) {
         cpu->pc = i->predictedTaken ? (i->pc + 4) : (i->pc + i->imm);
     } else if (i->opcode == OP_JAL || i->opcode == OP_JALP || i->opcode == OP_RET) {
@@ -414,10 +1322,33 @@ void handle_misprediction(ApexCpu* cpu, Instruction* i) {
     }
 }
 
-void execute_int_fu(ApexCpu* cpu) {
+// Checks a value-predicted result when it is produced. Consumers may have
+// run with the wrong value, so everything younger is squashed and
+// refetched, as after a branch mispredict.
+static void value_verify(ApexCpu* cpu, Instruction* i, int value) {
+    if(!i->valuePredicted || i->predictedValue == value) return;
+    cpu->prfValue[i->physRd] = value;
+    cpu->stats.vpFlushes++;
+    flush_after(cpu, i, NULL);
+    cpu->pc = i->pc + 4;
+}
+
+static ALWAYS_INLINE void execute_int_fu(ApexCpu* cpu, KernelSpec spec) {
     if(!cpu->intFuLatch) return;
     Instruction* i = cpu->intFuLatch;
+    cpu->stats.accesses[ACC_ALU]++;
     int result = 0; int flags = 0; int genFlags = FALSE; int mispredicted = FALSE;
+    if(needs_flags(i->opcode)) i->memoryAddress = i->pc + i->imm;  // taken target, recorded in the BTB
+    if(i->fused) {
+        // Compare half first; the branch half below tests its flags
+        switch(i->fusedOp) {
+            case OP_ADDL: result = i->rs1Value + i->fusedImm; break;
+            case OP_CMP: result = i->rs1Value - i->rs2Value; break;
+            default: result = i->rs1Value - i->fusedImm; break;
+        }
+        i->flagsValue = (result == 0) ? 1 : (result > 0) ? 2 : 4;
+        genFlags = TRUE;
+    }
     
     switch(i->opcode){
         case OP_ADD: case OP_ADDL:
@@ -434,6 +1365,7 @@ void execute_int_fu(ApexCpu* cpu) {
             i->memoryAddress = ((i->opcode == OP_LOAD) ? i->rs1Value : i->rs2Value) + i->imm;
             cpu->lsq[i->lsqIndex].memAddress = i->memoryAddress;
             cpu->lsq[i->lsqIndex].addressValid = TRUE;
+            cpu->stats.accesses[ACC_LSQ_WRITE]++;
             if(i->opcode == OP_STORE) {
                 cpu->lsq[i->lsqIndex].storeData = i->rs1Value;
                 cpu->lsq[i->lsqIndex].dataValid = TRUE;
@@ -446,6 +1378,7 @@ void execute_int_fu(ApexCpu* cpu) {
         case OP_JUMP:
             cpu->pc = i->rs1Value + i->imm;
             cpu->fetch1Latch = NULL; cpu->fetch2Latch = NULL; 
+            cpu->lsd.active = FALSE;
             cpu->fetchStalled = FALSE;
             cpu->wasFlushed = TRUE;
             break;
@@ -455,7 +1388,7 @@ void execute_int_fu(ApexCpu* cpu) {
             if(i->memoryAddress != i->predictedTarget) mispredicted = TRUE;
             
             // RUNTIME CHECK
-            if (cpu->predictor_enabled) {
+            if (spec.predictor) {
                 stack_push(&cpu->rap, result);
                 if(i->opcode == OP_JAL) update_ctp(cpu, i->pc, i->memoryAddress);
             }
@@ -468,7 +1401,7 @@ void execute_int_fu(ApexCpu* cpu) {
     }
     
     // RUNTIME CHECK
-    if (cpu->predictor_enabled) {
+    if (spec.predictor) {
         if(i->opcode == OP_BZ || i->opcode == OP_BNZ || i->opcode == OP_BP || i->opcode == OP_BN){
             int taken = !mispredicted ? i->predictedTaken : !i->predictedTaken;
             update_btb(cpu, i->pc, i->memoryAddress, taken);
@@ -478,18 +1411,21 @@ void execute_int_fu(ApexCpu* cpu) {
     if(mispredicted && i->bisIndex != -1) handle_misprediction(cpu, i);
     
     if(i->physRd != -1 && i->opcode != OP_LOAD)
-        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){i->physRd, result, FALSE};
+        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){i->physRd, result, FALSE, i->seq, CLUSTER_INT};
     if(genFlags && i->physCc != -1){
         if(result == 0) flags |= 1;
         if(result > 0) flags |= 2;
         if(result < 0) flags |= 4;
-        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){i->physCc, flags, TRUE};
+        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){i->physCc, flags, TRUE, i->seq, CLUSTER_INT};
+    }
+    if(i->opcode != OP_LOAD && i->opcode!= OP_STORE) {
+        cpu->rob[i->robIndex].status = 1;
+        cpu->stats.accesses[ACC_ROB_WRITE]++;
     }
-    if(i->opcode != OP_LOAD && i->opcode!= OP_STORE) cpu->rob[i->robIndex].status = 1;
     cpu->intFuLatch = NULL;
 }
 
-void execute_mul_fu(ApexCpu* cpu) {
+static void execute_mul_fu(ApexCpu* cpu) {
     for(int j=2; j>0; j--) cpu->mulPipeline[j] = cpu->mulPipeline[j-1];
     cpu->mulPipeline[0] = cpu->mulFuLatch;
     cpu->mulFuLatch = NULL;
@@ -497,97 +1433,272 @@ void execute_mul_fu(ApexCpu* cpu) {
     if(cpu->mulPipeline[2]) {
         Instruction* out = cpu->mulPipeline[2];
         int res = out->rs1Value * out->rs2Value;
-        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physRd, res, FALSE};
+        cpu->stats.accesses[ACC_MUL]++;
+        cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physRd, res, FALSE, out->seq, CLUSTER_MUL};
         int flags = 0;
         if(res == 0) flags |= 1; else if(res > 0) flags |= 2; else flags |= 4;
-        if(out->physCc != -1) cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physCc, flags, TRUE};
+        if(out->physCc != -1) cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physCc, flags, TRUE, out->seq, CLUSTER_MUL};
         cpu->rob[out->robIndex].status = 1;
+        cpu->stats.accesses[ACC_ROB_WRITE]++;
         cpu->mulPipeline[2] = NULL;
+        value_verify(cpu, out, res);
     }
 }
 
-void execute_mau(ApexCpu* cpu) {
+// The LSQ head enters the MAU only as the ROB head, once its address (and
+// a store's data) is known
+static int lsq_head_ready(ApexCpu* cpu) {
+    if(cpu->lsqCount == 0) return FALSE;
+    LsqEntry* head = &cpu->lsq[cpu->lsqHead];
+    if(!head->allocated || cpu->rob[cpu->robHead].instr != head->instr) return FALSE;
+    int loadReady = head->addressValid && head->instr->opcode == OP_LOAD;
+    int storeReady = head->addressValid && head->dataValid && head->instr->opcode == OP_STORE;
+    return loadReady || storeReady;
+}
+
+static ALWAYS_INLINE void execute_mau(ApexCpu* cpu, KernelSpec spec) {
+    // DTLB miss: the page walk holds the whole MAU
+    if(cpu->mauWalkCycles > 0) {
+        cpu->mauWalkCycles--;
+        cpu->stats.pageWalkCycles++;
+        return;
+    }
     cpu->mauPipeline[1] = cpu->mauPipeline[0];
     cpu->mauPipeline[0] = NULL;
     if(cpu->mauPipeline[1]) {
         Instruction* out = cpu->mauPipeline[1];
+        int status, val = 0;
         if(out->opcode == OP_LOAD) {
-            int val = cpu->dataMemory[out->memoryAddress];
-            cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physRd, val, FALSE};
+            if(spec.extras && cpu->sbCount > 0) cpu->stats.accesses[ACC_SB]++;
+            if(spec.extras && cpu->sbCount > 0 && sb_lookup(cpu, out->memoryAddress, &val)) {
+                status = MEM_OK;
+                cpu->stats.sbForwards++;
+            } else {
+                status = mem_read(cpu, out->memoryAddress, &val);
+                cpu->stats.accesses[ACC_MEM_READ]++;
+            }
+            cpu->pcProfile[code_index(out->pc)].loadCycles += cpu->clock - out->issueCycle;
+            cpu->forwardingBuffer[cpu->forwardingCount++] = (ForwardingData){out->physRd, val, FALSE, out->seq, CLUSTER_INT};
         } else {
-            cpu->dataMemory[out->memoryAddress] = cpu->lsq[out->lsqIndex].storeData;
+            if(cpu->debug && cpu->debug->watchCount) debug_store(cpu, out, cpu->lsq[out->lsqIndex].storeData);
+            status = mem_write(cpu, out->memoryAddress, cpu->lsq[out->lsqIndex].storeData);
+            cpu->stats.accesses[ACC_MEM_WRITE]++;
+        }
+        if(status != MEM_OK) {
+            memory_fault(cpu, out, status);
+            if(cpu->simulationHalted) return;
         }
         cpu->rob[out->robIndex].status = 1;
+        cpu->stats.accesses[ACC_ROB_WRITE]++;
         cpu->lsq[out->lsqIndex].allocated = FALSE;
         cpu->lsqHead = (cpu->lsqHead + 1) % LSQ_SIZE;
         cpu->lsqCount--;
+        if(out->opcode == OP_LOAD) value_verify(cpu, out, val);
+        // Stage 2 holds the access only while it is in flight; the entry
+        // may retire and be freed before the next squash looks at it
+        cpu->mauPipeline[1] = NULL;
     }
-    if(cpu->lsqCount > 0 && !cpu->mauPipeline[0]){
+    // Stores bound for the store buffer retire from the ROB instead
+    if(!cpu->mauPipeline[0] && lsq_head_ready(cpu) &&
+       !(spec.extras && cpu->config.storeBuffer > 0 && cpu->lsq[cpu->lsqHead].instr->opcode == OP_STORE)) {
         LsqEntry* head = &cpu->lsq[cpu->lsqHead];
-        if(head->allocated && cpu->rob[cpu->robHead].instr == head->instr) {
-            int loadReady = head->addressValid && head->instr->opcode == OP_LOAD;
-            int storeReady = head->addressValid && head->dataValid && head->instr->opcode == OP_STORE;
-            if(loadReady || storeReady) cpu->mauPipeline[0] = head->instr;
+        cpu->mauPipeline[0] = head->instr;
+        cpu->mauWalkCycles = spec.timedData ? dtlb_translate(cpu, head->memAddress) : 0;
+        if(cpu->mauWalkCycles > 0) cpu->pcProfile[code_index(head->instr->pc)].dtlbMisses++;
+    }
+}
+
+// Writes the oldest buffered line back in the background, one line at a
+// time; like a store in the MAU it takes two cycles plus any DTLB walk.
+// A partial line with nothing behind it is held briefly so that stores
+// to the rest of it can combine.
+static void store_buffer_drain(ApexCpu* cpu, KernelSpec spec) {
+    if(cpu->sbCount == 0) return;
+    StoreBufferEntry* e = &cpu->storeBuffer[cpu->sbHead];
+    if(!e->draining) {
+        if(cpu->sbCount == 1 && e->mask != (1 << SB_LINE_WORDS) - 1 &&
+           cpu->clock - e->allocCycle < SB_COMBINE_CYCLES) return;
+        e->draining = TRUE;
+        cpu->sbDrainCycles = 1 + (spec.timedData ? dtlb_translate(cpu, e->line * SB_LINE_WORDS) : 0);
+    }
+    if(cpu->sbDrainCycles > 0) {
+        cpu->sbDrainCycles--;
+        return;
+    }
+    sb_write_line(cpu, e);
+    cpu->stats.sbDrains++;
+    cpu->sbHead = (cpu->sbHead + 1) % STORE_BUFFER_MAX;
+    cpu->sbCount--;
+}
+
+// Whether source s (0 rs1, 1 rs2, 2 flags) can be consumed this cycle, and
+// if so whether it is read from the PRF. A value that arrived by broadcast
+// is caught off the bypass network one wakeup delay later; a value the
+// network does not cover, or that has already left it, is read from the
+// register file a cycle after it was written.
+static int operand_ready(const ApexCpu* cpu, const Instruction* instr, int s, int physReg, int cluster, int* reads) {
+    if(!(instr->wokenMask & (1 << s))) {
+        if(s < 2 && physReg != -1) (*reads)++;
+        return TRUE;
+    }
+    int fromMul = (instr->wokenFromMul >> s) & 1;
+    int bypassed = cpu->config.bypass == BYPASS_FULL ||
+                   (cpu->config.bypass == BYPASS_CLUSTER && fromMul == (cluster == CLUSTER_MUL));
+    int earliest = instr->wakeCycle[s] + cpu->config.wakeupDelay + !bypassed;
+    if(cpu->clock < earliest) return FALSE;
+    if(s < 2 && (!bypassed || cpu->clock > earliest)) (*reads)++;
+    return TRUE;
+}
+
+// PRF reads instr needs this cycle, or -1 while an operand is in flight
+static int issue_reads(const ApexCpu* cpu, const Instruction* instr, int cluster) {
+    int reads = 0;
+    if(!operand_ready(cpu, instr, 0, instr->physRs1, cluster, &reads)) return -1;
+    if(!operand_ready(cpu, instr, 1, instr->physRs2, cluster, &reads)) return -1;
+    if(cluster == CLUSTER_INT && !operand_ready(cpu, instr, 2, instr->physSrcCc, cluster, &reads)) return -1;
+    return reads;
+}
+
+// Results that have not been written back yet, each needing a write port
+static int pending_writes(const ApexCpu* cpu) {
+    int n = 0;
+    for(int k=0; k<cpu->forwardingCount; k++) n += !cpu->forwardingBuffer[k].isCc;
+    return n;
+}
+
+static int branch_taken(const Instruction* i) {
+    switch(i->opcode) {
+        case OP_BZ: return (i->flagsValue & 1) != 0;
+        case OP_BNZ: return (i->flagsValue & 1) == 0;
+        case OP_BP: return (i->flagsValue & 2) != 0;
+        case OP_BN: return (i->flagsValue & 4) != 0;
+        default: return FALSE;
+    }
+}
+
+// With early_resolve, a conditional branch does not wait to be selected
+// for the integer FU: the oldest one whose flags are ready resolves in the
+// cycle they arrive, leaving the FU to other work. A fused branch still
+// executes, since it computes its own flags.
+static void resolve_branches(ApexCpu* cpu, KernelSpec spec) {
+    int prfModel = cpu->config.prfReadPorts > 0 || cpu->config.bypass != BYPASS_FULL || cpu->config.wakeupDelay > 0;
+    int best = -1, minTime = INT_MAX;
+    for(int k=0; k<INT_RS_SIZE; k++) {
+        Instruction* i = cpu->intRs[k].instr;
+        if(!cpu->intRs[k].busy || !needs_flags(i->opcode) || i->fused) continue;
+        if(!i->flagsReady) {
+            if(i->physSrcCc == -1 || !bitmap_test(&cpu->cprfValid, i->physSrcCc)) continue;
+            i->flagsValue = cpu->cprfValue[i->physSrcCc];
+            i->flagsReady = TRUE;
+            cpu->stats.accesses[ACC_CPRF_READ]++;
         }
+        if(prfModel && issue_reads(cpu, i, CLUSTER_INT) < 0) continue;
+        if(cpu->intRs[k].dispatchTime < minTime) { minTime = cpu->intRs[k].dispatchTime; best = k; }
     }
+    if(best == -1) return;
+    Instruction* i = cpu->intRs[best].instr;
+    cpu->intRs[best].busy = FALSE;
+    cpu->stats.accesses[ACC_RS_READ]++;
+    i->issueCycle = cpu->clock;
+    cpu_hook(cpu, APEX_HOOK_ISSUE, i);
+    i->memoryAddress = i->pc + i->imm;
+    int taken = branch_taken(i);
+    if(spec.predictor) update_btb(cpu, i->pc, i->memoryAddress, taken);
+    cpu->rob[i->robIndex].status = 1;
+    cpu->stats.accesses[ACC_ROB_WRITE]++;
+    cpu->stats.earlyResolves++;
+    if((taken ? !i->predictedTaken : i->predictedTaken) && i->bisIndex != -1) handle_misprediction(cpu, i);
 }
 
-void instructionIssue(ApexCpu* cpu) {
+static ALWAYS_INLINE void instructionIssue(ApexCpu* cpu, KernelSpec spec) {
+    int portsUsed = 0;
+    // Off by default, so the generic kernel counts the same as a specialized one
+    int prfModel = spec.extras && (cpu->config.prfReadPorts > 0 || cpu->config.bypass != BYPASS_FULL ||
+                                   cpu->config.wakeupDelay > 0);
+    if(spec.extras && cpu->config.prfWritePorts > 0 && pending_writes(cpu) > cpu->config.prfWritePorts) {
+        if(!cpu->intFuLatch || !cpu->mulFuLatch) cpu->stats.writePortStalls++;
+        return;
+    }
     if(!cpu->intFuLatch) {
-        int best = -1, minTime = 2147483647;
+        int best = -1, minTime = 2147483647, bestReads = 0;
         for(int i=0; i<INT_RS_SIZE; i++) {
             if(cpu->intRs[i].busy && cpu->intRs[i].instr->rs1Ready && cpu->intRs[i].instr->rs2Ready) {
                 if(needs_flags(cpu->intRs[i].instr->opcode) && !cpu->intRs[i].instr->flagsReady) {
                     int tag = cpu->intRs[i].instr->physSrcCc;
-                    if(tag != -1 && cpu->cprf[tag].valid){
-                        cpu->intRs[i].instr->flagsValue = cpu->cprf[tag].value;
+                    if(tag != -1 && bitmap_test(&cpu->cprfValid, tag)){
+                        cpu->intRs[i].instr->flagsValue = cpu->cprfValue[tag];
                         cpu->intRs[i].instr->flagsReady = TRUE;
+                        cpu->stats.accesses[ACC_CPRF_READ]++;
                     }
                 }
                 if(!needs_flags(cpu->intRs[i].instr->opcode) || cpu->intRs[i].instr->flagsReady){
-                    if(cpu->intRs[i].dispatchTime < minTime) { minTime = cpu->intRs[i].dispatchTime; best = i; }
+                    int reads = prfModel ? issue_reads(cpu, cpu->intRs[i].instr, CLUSTER_INT) : 0;
+                    if(reads >= 0 && cpu->intRs[i].dispatchTime < minTime) { minTime = cpu->intRs[i].dispatchTime; best = i; bestReads = reads; }
                 }
             }
         }
+        if(best != -1 && cpu->config.prfReadPorts > 0 && bestReads > cpu->config.prfReadPorts) {
+            cpu->stats.readPortStalls++;
+            best = -1;
+        }
         if(best!=-1) {
+            portsUsed = bestReads;
+            cpu->stats.prfReads += bestReads;
             Instruction* issueInstr = cpu->intRs[best].instr;
-            if(issueInstr->physRs1 != -1) issueInstr->rs1Value = cpu->prf[issueInstr->physRs1].value;
-            if(issueInstr->physRs2 != -1) issueInstr->rs2Value = cpu->prf[issueInstr->physRs2].value;
+            if(issueInstr->physRs1 != -1) issueInstr->rs1Value = cpu->prfValue[issueInstr->physRs1];
+            if(issueInstr->physRs2 != -1) issueInstr->rs2Value = cpu->prfValue[issueInstr->physRs2];
+            cpu->stats.accesses[ACC_RS_READ]++;
+            cpu->stats.accesses[ACC_PRF_READ] += (issueInstr->physRs1 != -1) + (issueInstr->physRs2 != -1);
+            issueInstr->issueCycle = cpu->clock;
             cpu->intFuLatch = issueInstr;
             cpu->intRs[best].busy = FALSE;
+            cpu_hook(cpu, APEX_HOOK_ISSUE, issueInstr);
         }
     }
     
     if(!cpu->mulFuLatch){
-        int bestMul = -1, minMulTime = 2147483647;
+        int bestMul = -1, minMulTime = 2147483647, bestReads = 0;
         for(int i=0; i<MUL_RS_SIZE; i++) {
             if(cpu->mulRs[i].busy && cpu->mulRs[i].instr->rs1Ready && cpu->mulRs[i].instr->rs2Ready){
-                if(cpu->mulRs[i].dispatchTime < minMulTime) { minMulTime = cpu->mulRs[i].dispatchTime; bestMul = i; }
+                int reads = prfModel ? issue_reads(cpu, cpu->mulRs[i].instr, CLUSTER_MUL) : 0;
+                if(reads >= 0 && cpu->mulRs[i].dispatchTime < minMulTime) { minMulTime = cpu->mulRs[i].dispatchTime; bestMul = i; bestReads = reads; }
             }
         }
+        // The integer side was selected first and keeps its ports
+        if(bestMul != -1 && cpu->config.prfReadPorts > 0 && portsUsed + bestReads > cpu->config.prfReadPorts) {
+            cpu->stats.readPortStalls++;
+            bestMul = -1;
+        }
         if(bestMul != -1) {
+            cpu->stats.prfReads += bestReads;
             Instruction* issueInstr = cpu->mulRs[bestMul].instr;
-            if(issueInstr->physRs1 != -1) issueInstr->rs1Value = cpu->prf[issueInstr->physRs1].value;
-            if(issueInstr->physRs2 != -1) issueInstr->rs2Value = cpu->prf[issueInstr->physRs2].value;
+            if(issueInstr->physRs1 != -1) issueInstr->rs1Value = cpu->prfValue[issueInstr->physRs1];
+            if(issueInstr->physRs2 != -1) issueInstr->rs2Value = cpu->prfValue[issueInstr->physRs2];
+            cpu->stats.accesses[ACC_RS_READ]++;
+            cpu->stats.accesses[ACC_PRF_READ] += (issueInstr->physRs1 != -1) + (issueInstr->physRs2 != -1);
+            issueInstr->issueCycle = cpu->clock;
             cpu->mulFuLatch = issueInstr;
             cpu->mulRs[bestMul].busy = FALSE;
+            cpu_hook(cpu, APEX_HOOK_ISSUE, issueInstr);
         }
     }
 }
 
-void renameSource(ApexCpu* cpu, Instruction* i,int archReg, int opNum){
+static void renameSource(ApexCpu* cpu, Instruction* i,int archReg, int opNum){
     if(archReg == -1) {
         if(opNum == 1) i->rs1Ready = TRUE; else i->rs2Ready = TRUE;
         return;
     }
     int phys = cpu->rat[archReg];
+    cpu->stats.accesses[ACC_RAT_READ]++;
     if(phys == -1) {
         int val = cpu->arf[archReg];
+        cpu->stats.accesses[ACC_ARF_READ]++;
         if(opNum == 1) { i->rs1Value = val; i->rs1Ready = TRUE; }
         else { i->rs2Value = val; i->rs2Ready = TRUE; }
     } else {
         if(opNum == 1) i->physRs1 = phys; else i->physRs2 = phys;
-        if(cpu->prf[phys].valid) {
+        if(bitmap_test(&cpu->prfValid, phys)) {
             if(opNum == 1) i->rs1Ready = TRUE; else i->rs2Ready = TRUE;
         } else {
             if(opNum == 1) i->rs1Ready = FALSE; else i->rs2Ready = FALSE;
@@ -595,18 +1706,27 @@ void renameSource(ApexCpu* cpu, Instruction* i,int archReg, int opNum){
     }
 }
 
-void rename_2_dispatch(ApexCpu* cpu){
-    if(!cpu->dispatchLatch) return;
-    if(cpu->robCount == ROB_SIZE || cpu->lsqCount == LSQ_SIZE) return;
-    Instruction* i = cpu->dispatchLatch;
+// No ROB, LSQ, checkpoint or reservation station slot for i
+static int dispatch_blocked(ApexCpu* cpu, const Instruction* i) {
+    if(cpu->robCount == ROB_SIZE || cpu->lsqCount == LSQ_SIZE) return TRUE;
+    if(is_branch(i) && cpu->bisCount >= cpu->bisLimit) return TRUE;
     if(i->opcode == OP_MUL) {
-        int full = 1; for(int k=0; k<MUL_RS_SIZE; k++) if(!cpu->mulRs[k].busy) { full = 0; break; }
-        if(full) return;
+        for(int k=0; k<MUL_RS_SIZE; k++) if(!cpu->mulRs[k].busy) return FALSE;
     } else {
-        int full = 1; for(int k=0;k<INT_RS_SIZE; k++) if(!cpu->intRs[k].busy) { full = 0; break; }
-        if(full) return;
+        for(int k=0; k<INT_RS_SIZE; k++) if(!cpu->intRs[k].busy) return FALSE;
     }
+    return TRUE;
+}
+
+static ALWAYS_INLINE void rename_2_dispatch(ApexCpu* cpu, KernelSpec spec){
+    if(!cpu->dispatchLatch) return;
+    Instruction* i = cpu->dispatchLatch;
+    if(dispatch_blocked(cpu, i)) return;
     int robIdx = cpu->robTail;
+    // Squashed entries are not cleared, so nothing may carry over
+    memset(&cpu->rob[robIdx], 0, sizeof(RobEntry));
+    cpu->rob[robIdx].bisIndex = -1;
+    cpu->rob[robIdx].lsqIndex = -1;
     cpu->rob[robIdx].instr = i;
     cpu->rob[robIdx].status = 0;
     cpu->rob[robIdx].archRd = i->rd;
@@ -617,31 +1737,44 @@ void rename_2_dispatch(ApexCpu* cpu){
     if(i->physCc != -1) cpu->rob[robIdx].writesCc= TRUE;
     
     i->robIndex = robIdx;
+    i->seq = ++cpu->globalDispatchCounter;
+    i->dispatchCycle = cpu->clock;
     cpu->robTail = (cpu->robTail + 1) % ROB_SIZE;
     cpu->robCount++;
+    cpu->stats.accesses[ACC_ROB_WRITE]++;
     
     renameSource(cpu, i, i->rs1, 1);
     renameSource(cpu, i, i->rs2, 2);
     
-    if(is_branch(i)) {
+    if(i->fused) {
+        i->flagsReady = TRUE;   // computed by its own compare half
+    } else if(is_branch(i)) {
         if(cpu->ratCc != -1) i->physSrcCc = cpu->ratCc;
-        if(cpu->ratCc != -1 && cpu->cprf[cpu->ratCc].valid) {
-            i->flagsValue = cpu->cprf[cpu->ratCc].value;
+        cpu->stats.accesses[ACC_RAT_READ]++;
+        if(cpu->ratCc != -1 && bitmap_test(&cpu->cprfValid, cpu->ratCc)) {
+            i->flagsValue = cpu->cprfValue[cpu->ratCc];
             i->flagsReady = TRUE;
+            cpu->stats.accesses[ACC_CPRF_READ]++;
         }
     }
+    // The old mapping, saved in the ROB entry, is read with the update
+    cpu->stats.accesses[ACC_RAT_READ] += (i->rd != -1) + (i->physCc != -1);
+    cpu->stats.accesses[ACC_RAT_WRITE] += (i->rd != -1) + (i->physCc != -1);
     if(i->rd != -1) cpu->rat[i->rd] = i->physRd;
     if(i->physCc != -1) cpu->ratCc = i->physCc;
+    if(spec.extras) vp_dispatch(cpu, i);
     
     if(is_branch(i)) {
-        BisEntry b;
-        b.branchPc = i->pc;
-        b.robTailSnapshot = robIdx;
-        memcpy(b.ratSnapshot, cpu->rat, sizeof(cpu->rat));
-        b.ratCcSnapshot = cpu->ratCc;
-        b.freeListSnapshot = cpu->freeListPrf;
-        b.freeListCcSnapshot = cpu->freeListCprf;
-        cpu->bis[cpu->bisTail] = b;
+        BisEntry* b = &cpu->bis[cpu->bisTail];
+        b->branchPc = i->pc;
+        b->robTailSnapshot = robIdx;
+        if(!(spec.extras && cpu->config.robWalk)) {
+            memcpy(b->ratSnapshot, cpu->rat, sizeof(cpu->rat));
+            b->ratCcSnapshot = cpu->ratCc;
+            b->freeListSnapshot = cpu->freeListPrf;
+            b->freeListCcSnapshot = cpu->freeListCprf;
+            cpu->stats.accesses[ACC_CHECKPOINT]++;
+        }
         i->bisIndex = cpu->bisTail;
         cpu->rob[robIdx].isBranch = TRUE;
         cpu->rob[robIdx].bisIndex = cpu->bisTail;
@@ -649,7 +1782,6 @@ void rename_2_dispatch(ApexCpu* cpu){
         cpu->bisCount++;
     }
     
-    cpu->globalDispatchCounter++;
     if(i->opcode == OP_LOAD || i->opcode == OP_STORE) {
         cpu->lsq[cpu->lsqTail].allocated = TRUE;
         cpu->lsq[cpu->lsqTail].instr = i;
@@ -659,6 +1791,7 @@ void rename_2_dispatch(ApexCpu* cpu){
         cpu->rob[robIdx].lsqIndex = cpu->lsqTail;
         cpu->lsqTail = (cpu->lsqTail + 1) % LSQ_SIZE;
         cpu->lsqCount++;
+        cpu->stats.accesses[ACC_LSQ_WRITE]++;
         for(int k=0; k<INT_RS_SIZE; k++) {
             if(!cpu->intRs[k].busy) {
                 cpu->intRs[k].busy = TRUE; cpu->intRs[k].instr = i;
@@ -683,51 +1816,154 @@ void rename_2_dispatch(ApexCpu* cpu){
             }
         }
     }
+    cpu->stats.accesses[ACC_RS_WRITE]++;
+    cpu_hook(cpu, APEX_HOOK_DISPATCH, i);
     cpu->dispatchLatch = NULL;
 }
 
-void decode_rename_1(ApexCpu* cpu) {
+static int fusible_head(Opcode op) {
+    return (op == OP_CMP || op == OP_CML || op == OP_ADDL || op == OP_SUBL);
+}
+
+// Folds a compare (or ADDL/SUBL) into the conditional branch right after
+// it. The branch carries both halves through the back end as one
+// macro-op: one ROB entry, one RS slot, no flags wakeup.
+static int fuse_pair(const Instruction* head, Instruction* br) {
+    if(!fusible_head(head->opcode) || !needs_flags(br->opcode) || br->pc != head->pc + 4) return FALSE;
+    char name[sizeof(br->opcodeStr)];
+    snprintf(name, sizeof(name), "%.7s+%.7s", head->opcodeStr, br->opcodeStr);
+    strcpy(br->opcodeStr, name);
+    br->fused = TRUE;
+    br->fusedOp = head->opcode;
+    br->fusedPc = head->pc;
+    br->fusedImm = head->imm;
+    br->rd = head->rd; br->rs1 = head->rs1; br->rs2 = head->rs2;
+    br->fetchCycle = head->fetchCycle;
+    return TRUE;
+}
+
+// Decode-time fusion with the branch waiting in F1
+static Instruction* fuse_with_branch(ApexCpu* cpu, Instruction* head) {
+    Instruction* br = cpu->fetch1Latch;
+    if(!br || !fuse_pair(head, br)) return head;
+    instr_free(cpu, head);
+    cpu->fetch1Latch = NULL;
+    return br;
+}
+
+static ALWAYS_INLINE void decode_rename_1(ApexCpu* cpu, KernelSpec spec) {
     if(!cpu->fetch2Latch) return;
     if(cpu->dispatchLatch) return;
+    if(cpu->clock < cpu->renameResumeCycle) return;
     Instruction* i = cpu->fetch2Latch;
     if(i->opcode == OP_JUMP) {
         cpu->fetchStalled = TRUE;
-        if(cpu->fetch1Latch) { free(cpu->fetch1Latch); cpu->fetch1Latch = NULL; }
+        if(cpu->fetch1Latch) { instr_free(cpu, cpu->fetch1Latch); cpu->fetch1Latch = NULL; }
     }
     
+    if(spec.extras && cpu->config.fusion) i = cpu->fetch2Latch = fuse_with_branch(cpu, i);
+    
+    // Both registers must be available before either is taken
+    if(i->rd != -1 && bitmap_is_empty(&cpu->freeListPrf)) return;
+    if(writes_flags(i) && bitmap_is_empty(&cpu->freeListCprf)) return;
     if(i->rd != -1) {
-        if(queue_is_empty(&cpu->freeListPrf)) return;
-        int p = queue_dequeue(&cpu->freeListPrf);
+        int p = bitmap_take_first(&cpu->freeListPrf);
         i->physRd = p;
-        cpu->prf[p].allocated = TRUE;
-        cpu->prf[p].valid = FALSE;
+        bitmap_clear(&cpu->prfValid, p);
     }
-    if(sets_flags(i->opcode)) {
-        if(queue_is_empty(&cpu->freeListCprf)) return;
-        int c = queue_dequeue(&cpu->freeListCprf);
+    if(writes_flags(i)) {
+        int c = bitmap_take_first(&cpu->freeListCprf);
         i->physCc = c;
-        cpu->cprf[c].allocated = TRUE;
-        cpu->cprf[c].valid = FALSE;
+        bitmap_clear(&cpu->cprfValid, c);
     }
     cpu->dispatchLatch = i;
     cpu->fetch2Latch = NULL;
 }
 
-void fetch_stage_2(ApexCpu* cpu) {
+static void fetch_stage_2(ApexCpu* cpu) {
     if(!cpu->fetch1Latch) return;
     if(cpu->fetch2Latch) { cpu->wasStalled = TRUE; return; }
     cpu->fetch2Latch = cpu->fetch1Latch;
     cpu->fetch1Latch = NULL;
 }
 
-void fetch_stage_1(ApexCpu* cpu) {
+// Counts consecutive predicted-taken trips of a short backward branch over
+// straight-line code and, once the loop looks stable, captures its body.
+static void lsd_observe(ApexCpu* cpu, const Instruction* br) {
+    LoopBuffer* l = &cpu->lsd;
+    int target = br->predictedTarget;
+    int ops = (br->pc - target) / 4 + 1;
+    if(target > br->pc || ops > cpu->config.lsdSize || code_index(target) < 0) return;
+    if(br->pc != l->branchPc) { l->branchPc = br->pc; l->trips = 0; }
+    if(++l->trips < LSD_LOCK_TRIPS) return;
+    const Instruction* body = &cpu->codeMemory[code_index(target)];
+    for(int k=0; k<ops - 1; k++) {
+        if(is_branch(&body[k]) || body[k].opcode == OP_JUMP || body[k].opcode == OP_HALT) return;
+    }
+    memcpy(l->ops, body, ops * sizeof(Instruction));
+    l->count = ops;
+    Instruction* last = &l->ops[ops - 1];
+    last->predictedTaken = TRUE;
+    last->predictedTarget = target;
+    strcpy(last->predictionInfo, "[LSD]");
+    // Store the loop-closing pair already fused, as a decoded-op cache would
+    if(cpu->config.fusion && ops > 1 && fuse_pair(&l->ops[ops - 2], last)) {
+        l->ops[ops - 2] = *last;
+        l->count--;
+    }
+    l->startPc = target;
+    l->next = 0;
+    l->codeVersion = cpu->codeVersion;
+    l->active = TRUE;
+    cpu->stats.lsdCaptures++;
+}
+
+// Replays the captured loop into decode until a flush ends it. The ops are
+// already decoded and the closing branch is predicted taken, so there is no
+// I-cache access and no fetch-side prediction.
+static void lsd_stream(ApexCpu* cpu) {
+    LoopBuffer* l = &cpu->lsd;
+    if(l->codeVersion != cpu->codeVersion) { l->active = FALSE; return; }
+    if(cpu->fetch2Latch) { cpu->wasStalled = TRUE; return; }
+    Instruction* i = instr_alloc(cpu);
+    *i = l->ops[l->next];
+    i->fetchCycle = cpu->clock;
+    cpu_hook(cpu, APEX_HOOK_FETCH, i);
+    cpu->fetch2Latch = i;
+    cpu->stats.lsdOps++;
+    cpu->stats.accesses[ACC_LSD]++;
+    l->next = (l->next + 1) % l->count;
+    cpu->pc = (l->next == 0) ? l->startPc : i->pc + 4;
+}
+
+static ALWAYS_INLINE void fetch_stage_1(ApexCpu* cpu, KernelSpec spec) {
     if(cpu->fetch1Latch || cpu->fetchStalled) { cpu->wasStalled = TRUE; return; }
     if(cpu->simulationHalted) return;
-    Instruction* i = create_instruction();
+    if(spec.extras && cpu->lsd.active) {
+        lsd_stream(cpu);
+        if(cpu->lsd.active) return;
+    }
+    // Wrong-path PC outside code memory: idle until the redirect arrives
+    if(code_index(cpu->pc) < 0) { cpu->wasStalled = TRUE; return; }
+    if(cpu->clock < cpu->redirectReadyCycle) {
+        cpu->stats.redirectStallCycles++;
+        cpu->wasStalled = TRUE;
+        return;
+    }
+    if(spec.timedFetch && !fetch_memory_ready(cpu)) {
+        cpu->stats.fetchStallCycles++;
+        cpu->wasStalled = TRUE;
+        return;
+    }
+    Instruction* i = instr_alloc(cpu);
     *i = cpu->codeMemory[(cpu->pc - 4000) / 4];
+    i->fetchCycle = cpu->clock;
+    cpu->stats.fetchedOps++;
+    cpu->stats.accesses[ACC_FETCH]++;
+    cpu_hook(cpu, APEX_HOOK_FETCH, i);
     
     // RUNTIME CHECK
-    if (cpu->predictor_enabled) {
+    if (spec.predictor) {
         if(i->opcode == OP_JAL) {
             int predictedTarget = ctp_lookup(cpu, cpu->pc);
             if(predictedTarget != -1) {
@@ -741,6 +1977,7 @@ void fetch_stage_1(ApexCpu* cpu) {
             }
         } else if(i->opcode == OP_BZ || i->opcode == OP_BNZ || i->opcode == OP_BP || i->opcode == OP_BN) {
             int match = -1;
+            cpu->stats.accesses[ACC_BTB]++;
             for(int k=0; k<8; k++) {
                 if(cpu->btb[k].valid && cpu->btb[k].tagPc == cpu->pc) {
                     cpu->btb[k].lruTime = cpu->clock;
@@ -754,6 +1991,7 @@ void fetch_stage_1(ApexCpu* cpu) {
                     i->predictedTarget = cpu->btb[match].targetAddress;
                     cpu->pc = cpu->btb[match].targetAddress;
                     cpu->fetch1Latch = i;
+                    if(spec.extras && cpu->config.lsdSize > 0) lsd_observe(cpu, i);
                     return;
                 }
             } else { strcpy(i->predictionInfo, "[BTB MISS]"); }
@@ -772,14 +2010,14 @@ void fetch_stage_1(ApexCpu* cpu) {
     cpu->pc += 4;
 }
 
-void print_stage_content(const char* stageName, Instruction* instr) {
+static void print_stage_content(ApexCpu* cpu, const char* stageName, Instruction* instr) {
     char buffer[128];
     print_instruction_str(instr, buffer);
     if(instr && strlen(instr->predictionInfo) > 0) {
         strcat(buffer, " ");
         strcat(buffer, instr->predictionInfo);
     }
-    printf("| %-7s | %-65s |\n", stageName, buffer);
+    cpu_print(cpu, "| %-7s | %-65s |\n", stageName, buffer);
 }
 
 void cpu_display(ApexCpu* cpu) {
@@ -787,63 +2025,63 @@ void cpu_display(ApexCpu* cpu) {
 }
 
 void cpu_display_all_stages(ApexCpu* cpu) {
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| Cycle: %-4d | PC: %-5d | Stalled: %s | Flushed: %s | ROB: %2d/%d | LSQ: %d/%d |\n", 
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| Cycle: %-4d | PC: %-5d | Stalled: %s | Flushed: %s | ROB: %2d/%d | LSQ: %d/%d |\n", 
             cpu->clock, cpu->pc, 
             cpu->fetchStalled ? "YES" : "NO ", 
             cpu->wasFlushed ? "YES" : "NO ",
             cpu->robCount, ROB_SIZE,
             cpu->lsqCount, LSQ_SIZE);
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| STAGE   | INSTRUCTION                                                       |\n");
-    printf("+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| STAGE   | INSTRUCTION                                                       |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
     
-    print_stage_content("F1", cpu->fetch1Latch);
-    print_stage_content("F2", cpu->fetch2Latch);
-    print_stage_content("D1/RN", cpu->dispatchLatch);
-    printf("| %-7s | %-65s |\n", "RN2/DIS", (cpu->dispatchLatch) ? "Processing..." : "(Empty)");
-    print_stage_content("IntFU", cpu->intFuLatch);
+    print_stage_content(cpu, "F1", cpu->fetch1Latch);
+    print_stage_content(cpu, "F2", cpu->fetch2Latch);
+    print_stage_content(cpu, "D1/RN", cpu->dispatchLatch);
+    cpu_print(cpu, "| %-7s | %-65s |\n", "RN2/DIS", (cpu->dispatchLatch) ? "Processing..." : "(Empty)");
+    print_stage_content(cpu, "IntFU", cpu->intFuLatch);
     
     for(int i=0; i<3; i++) {
         char name[10]; sprintf(name, "MulFU-%d", i+1);
-        print_stage_content(name, cpu->mulPipeline[i]);
+        print_stage_content(cpu, name, cpu->mulPipeline[i]);
     }
     
     for(int i=0; i<2; i++) {
         char name[10]; sprintf(name, "MemFU-%d", i+1);
-        print_stage_content(name, cpu->mauPipeline[i]);
+        print_stage_content(cpu, name, cpu->mauPipeline[i]);
     }
     
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| RENAME TABLE (RAT)                                                          |\n");
-    printf("+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| RENAME TABLE (RAT)                                                          |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
     for(int i=0; i<32; i+=8) {
-        printf("| ");
+        cpu_print(cpu, "| ");
         for(int j=i; j<i+8 && j<32; j++) {
-            printf("R%02d:P%-2d ", j, cpu->rat[j]);
+            cpu_print(cpu, "R%02d:P%-2d ", j, cpu->rat[j]);
         }
-        printf("|\n");
+        cpu_print(cpu, "|\n");
     }
-    printf("| CC-RAT: %-2s                                                                |\n", (cpu->ratCc == -1 ? "-" : "P"));
+    cpu_print(cpu, "| CC-RAT: %-2s                                                                |\n", (cpu->ratCc == -1 ? "-" : "P"));
 
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| ARCHITECTURAL REGISTER FILE (ARF) - (Partial View R0-R15)                   |\n");
-    printf("+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| ARCHITECTURAL REGISTER FILE (ARF) - (Partial View R0-R15)                   |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
     for(int i=0; i<16; i+=8) {
-        printf("| ");
+        cpu_print(cpu, "| ");
         for(int j=i; j<i+8; j++) {
-            printf("R%02d:%-3d ", j, cpu->arf[j]);
+            cpu_print(cpu, "R%02d:%-3d ", j, cpu->arf[j]);
         }
-        printf(" |\n");
+        cpu_print(cpu, " |\n");
     }
 
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| RESERVATION STATIONS (Busy Entries)                                         |\n");
-    printf("+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| RESERVATION STATIONS (Busy Entries)                                         |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
     int printedRS = 0;
     for(int i=0; i<INT_RS_SIZE; i++) {
         if(cpu->intRs[i].busy) {
-            printf("| IntRS[%d]: %-4s (R1r:%d R2r:%d) -> ROB[%d]                                  |\n", 
+            cpu_print(cpu, "| IntRS[%d]: %-4s (R1r:%d R2r:%d) -> ROB[%d]                                  |\n", 
                    i, cpu->intRs[i].instr->opcodeStr, 
                    cpu->intRs[i].instr->rs1Ready, cpu->intRs[i].instr->rs2Ready,
                    cpu->intRs[i].instr->robIndex);
@@ -852,23 +2090,23 @@ void cpu_display_all_stages(ApexCpu* cpu) {
     }
     for(int i=0; i<MUL_RS_SIZE; i++) {
         if(cpu->mulRs[i].busy) {
-            printf("| MulRS[%d]: %-4s (R1r:%d R2r:%d) -> ROB[%d]                                  |\n", 
+            cpu_print(cpu, "| MulRS[%d]: %-4s (R1r:%d R2r:%d) -> ROB[%d]                                  |\n", 
                    i, cpu->mulRs[i].instr->opcodeStr, 
                    cpu->mulRs[i].instr->rs1Ready, cpu->mulRs[i].instr->rs2Ready,
                    cpu->mulRs[i].instr->robIndex);
             printedRS++;
         }
     }
-    if(printedRS == 0) printf("| (All RS Entries Empty)                                                      |\n");
+    if(printedRS == 0) cpu_print(cpu, "| (All RS Entries Empty)                                                      |\n");
     
-    printf("+-----------------------------------------------------------------------------+\n");
-    printf("| REORDER BUFFER (Head -> Tail)                                               |\n");
-    printf("+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| REORDER BUFFER (Head -> Tail)                                               |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
     int count = 0;
     if(cpu->robCount > 0) {
         int curr = cpu->robHead;
         while(count < cpu->robCount) {
-             printf("| ROB[%2d]: %-5s Status:%s (ArchRd: R%-2d PhysRd: P%-2d)                   |\n", 
+             cpu_print(cpu, "| ROB[%2d]: %-5s Status:%s (ArchRd: R%-2d PhysRd: P%-2d)                   |\n", 
                 curr, 
                 cpu->rob[curr].instr->opcodeStr,
                 cpu->rob[curr].status ? "CMT" : "EXE",
@@ -877,52 +2115,1113 @@ void cpu_display_all_stages(ApexCpu* cpu) {
              count++;
         }
     } else {
-        printf("| (Empty)                                                                     |\n");
+        cpu_print(cpu, "| (Empty)                                                                     |\n");
     }
     
     // RUNTIME CHECK FOR DISPLAY
     if (cpu->predictor_enabled) {
-        printf("+-----------------------------------------------------------------------------+\n");
-        printf("| PREDICTOR STATE                                                             |\n");
-        printf("+-----------------------------------------------------------------------------+\n");
-        printf("| RAP Stack: ");
-        for(int k = cpu->rap.top; k >= 0; k--) printf("%d ", cpu->rap.items[k]);
-        printf("\n| BTB Valid Entries:\n");
+        cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+        cpu_print(cpu, "| PREDICTOR STATE                                                             |\n");
+        cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+        cpu_print(cpu, "| RAP Stack: ");
+        for(int k = cpu->rap.top; k >= 0; k--) cpu_print(cpu, "%d ", cpu->rap.items[k]);
+        cpu_print(cpu, "\n| BTB Valid Entries:\n");
         for(int k=0; k<8; k++) {
-            if(cpu->btb[k].valid) printf("|  [%d] PC:%d -> Tgt:%d (Hist:%d)\n", k, cpu->btb[k].tagPc, cpu->btb[k].targetAddress, cpu->btb[k].history);
+            if(cpu->btb[k].valid) cpu_print(cpu, "|  [%d] PC:%d -> Tgt:%d (Hist:%d)\n", k, cpu->btb[k].tagPc, cpu->btb[k].targetAddress, cpu->btb[k].history);
         }
-        printf("| CTP Valid Entries:\n");
+        cpu_print(cpu, "| CTP Valid Entries:\n");
         int ctpEmpty = 1;
         for(int k=0; k<4; k++) {
             if(cpu->ctp[k].valid) {
-                printf("|  [%d] PC:%d -> Tgt:%d\n", k, cpu->ctp[k].tagPc, cpu->ctp[k].targetAddress);
+                cpu_print(cpu, "|  [%d] PC:%d -> Tgt:%d\n", k, cpu->ctp[k].tagPc, cpu->ctp[k].targetAddress);
                 ctpEmpty = 0;
             }
         }
+        if(ctpEmpty) cpu_print(cpu, "|  (none)\n");
     }
     
-    printf("+-----------------------------------------------------------------------------+\n\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n\n");
+}
+
+// Lists the n branches that threw away the most work
+static void display_hot_branches(ApexCpu* cpu, int n) {
+    int shown[CODE_MEMORY_SIZE] = {0};
+    for(int k=0; k<n; k++) {
+        int best = -1;
+        for(int c=0; c<CODE_MEMORY_SIZE; c++) {
+            if(shown[c] || cpu->branchStats[c].mispredicts == 0) continue;
+            if(best == -1 || cpu->branchStats[c].wastedCycles > cpu->branchStats[best].wastedCycles) best = c;
+        }
+        if(best == -1) break;
+        shown[best] = TRUE;
+        BranchStats* b = &cpu->branchStats[best];
+        char line[96];
+        snprintf(line, sizeof(line), "  PC %-5d %-4s %6lld mispredicts %7lld squashed %8lld wasted cycles",
+                 4000 + best * 4, cpu->codeMemory[best].opcodeStr, b->mispredicts, b->squashed, b->wastedCycles);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+}
+
+void cpu_display_stats(ApexCpu* cpu) {
+    char line[96];
+    double kilo = cpu->instructionsRetired / 1000.0;
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    cpu_print(cpu, "| STATISTICS                                                                  |\n");
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n");
+    snprintf(line, sizeof(line), "Cycles: %d  Retired: %d  IPC: %.3f", cpu->clock, cpu->instructionsRetired,
+             cpu->clock ? (double)cpu->instructionsRetired / cpu->clock : 0.0);
+    cpu_print(cpu, "| %-75s |\n", line);
+    if(cpu->icacheSets > 0) {
+        snprintf(line, sizeof(line), "L1I: %lld accesses, %lld misses, MPKI %.2f",
+                 cpu->stats.icacheAccesses, cpu->stats.icacheMisses, kilo > 0 ? cpu->stats.icacheMisses / kilo : 0.0);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.itlbEntries > 0) {
+        snprintf(line, sizeof(line), "ITLB: %lld accesses, %lld misses, MPKI %.2f",
+                 cpu->stats.itlbAccesses, cpu->stats.itlbMisses, kilo > 0 ? cpu->stats.itlbMisses / kilo : 0.0);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    snprintf(line, sizeof(line), "Fetch stall cycles (I-side miss): %lld", cpu->stats.fetchStallCycles);
+    cpu_print(cpu, "| %-75s |\n", line);
+    if(cpu->config.dtlbEntries > 0) {
+        snprintf(line, sizeof(line), "DTLB: %lld accesses, %lld misses (%.2f%%), %lld walks, %lld walk cycles",
+                 cpu->stats.dtlbAccesses, cpu->stats.dtlbMisses,
+                 cpu->stats.dtlbAccesses ? 100.0 * cpu->stats.dtlbMisses / cpu->stats.dtlbAccesses : 0.0,
+                 cpu->stats.pageWalks, cpu->stats.pageWalkCycles);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->stats.ffInstructions > 0) {
+        snprintf(line, sizeof(line), "Fast-forward: %lld instructions, %lld blocks translated",
+                 cpu->stats.ffInstructions, cpu->stats.ffBlocksTranslated);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->stats.recoveries > 0) {
+        snprintf(line, sizeof(line), "Recovery (%s): %lld, %.2f cycles avg, %.0f ns host avg",
+                 cpu->config.robWalk ? "ROB walk" : "checkpoint", cpu->stats.recoveries,
+                 (double)cpu->stats.recoveryCycles / cpu->stats.recoveries,
+                 (double)cpu->stats.recoveryHostNs / cpu->stats.recoveries);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->stats.branches > 0) {
+        snprintf(line, sizeof(line), "Branches: %lld committed, %lld mispredicted (%.2f%%)", cpu->stats.branches,
+                 cpu->stats.branchMispredicts, 100.0 * cpu->stats.branchMispredicts / cpu->stats.branches);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.earlyResolve) {
+        snprintf(line, sizeof(line), "Early resolution: %lld branches resolved as their flags arrived",
+                 cpu->stats.earlyResolves);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->stats.squashedInstructions > 0) {
+        snprintf(line, sizeof(line), "Squashed: %lld instructions, %lld wasted cycles, %lld redirect stalls",
+                 cpu->stats.squashedInstructions, cpu->stats.wastedCycles, cpu->stats.redirectStallCycles);
+        cpu_print(cpu, "| %-75s |\n", line);
+        display_hot_branches(cpu, 5);
+    }
+    snprintf(line, sizeof(line), "Window: avg ROB %.2f of %d, avg RS %.2f of %d, avg LSQ %.2f of %d",
+             cpu->clock ? (double)cpu->stats.robOccupancy / cpu->clock : 0.0, ROB_SIZE,
+             cpu->clock ? (double)cpu->stats.rsOccupancy / cpu->clock : 0.0, INT_RS_SIZE + MUL_RS_SIZE,
+             cpu->clock ? (double)cpu->stats.lsqOccupancy / cpu->clock : 0.0, LSQ_SIZE);
+    cpu_print(cpu, "| %-75s |\n", line);
+    if(cpu->config.fusion) {
+        snprintf(line, sizeof(line), "Fusion: %lld pairs, %.1f%% of retired instructions",
+                 cpu->stats.fusedPairs, cpu->instructionsRetired ? 200.0 * cpu->stats.fusedPairs / cpu->instructionsRetired : 0.0);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.lsdSize > 0) {
+        long long ops = cpu->stats.fetchedOps + cpu->stats.lsdOps;
+        snprintf(line, sizeof(line), "Loop buffer: %lld captures, %lld of %lld ops streamed (%.1f%% hit rate)",
+                 cpu->stats.lsdCaptures, cpu->stats.lsdOps, ops, ops ? 100.0 * cpu->stats.lsdOps / ops : 0.0);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.valuePred != VP_OFF) {
+        snprintf(line, sizeof(line), "VP (%s): %lld eligible, %.1f%% coverage, %.1f%% accuracy, %lld flushes",
+                 cpu->config.valuePred == VP_STRIDE ? "stride" : "last value", cpu->stats.vpEligible,
+                 cpu->stats.vpEligible ? 100.0 * cpu->stats.vpPredicted / cpu->stats.vpEligible : 0.0,
+                 cpu->stats.vpPredicted ? 100.0 * cpu->stats.vpCorrect / cpu->stats.vpPredicted : 0.0, cpu->stats.vpFlushes);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.prfReadPorts > 0 || cpu->config.prfWritePorts > 0 || cpu->config.bypass != BYPASS_FULL ||
+       cpu->config.wakeupDelay > 0) {
+        snprintf(line, sizeof(line), "PRF: %lld reads, %lld read-port stalls, %lld write-port stalls, %lld deferred",
+                 cpu->stats.prfReads, cpu->stats.readPortStalls, cpu->stats.writePortStalls, cpu->stats.deferredWrites);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    if(cpu->config.storeBuffer > 0) {
+        snprintf(line, sizeof(line), "Store buffer: %lld stores, %.1f%% combined, %lld lines, %lld forwards, %lld full",
+                 cpu->stats.sbStores, cpu->stats.sbStores ? 100.0 * cpu->stats.sbCombined / cpu->stats.sbStores : 0.0,
+                 cpu->stats.sbDrains, cpu->stats.sbForwards, cpu->stats.sbFullCycles);
+        cpu_print(cpu, "| %-75s |\n", line);
+    }
+    ApexEnergy energy;
+    cpu_energy(cpu, &energy);
+    snprintf(line, sizeof(line), "Energy: %.1f nJ dynamic, %.1f mW at %d MHz, EDP %.1f nJ*us",
+             energy.dynamicNj, energy.averageMw, cpu->config.clockMhz, energy.edp * 1e15);
+    cpu_print(cpu, "| %-75s |\n", line);
+    // Shares by part of the core, in ApexAccess order
+    static const int groupEnd[] = {ACC_RAT_READ, ACC_ARF_READ, ACC_RS_WRITE, ACC_ALU, ACC_MEM_READ, ACC_COUNT};
+    double share[6] = {0};
+    for(int k=0, g=0; k<ACC_COUNT; k++) {
+        while(k >= groupEnd[g]) g++;
+        share[g] += energy.dynamicNj > 0 ? 100.0 * energy.accessNj[k] / energy.dynamicNj : 0.0;
+    }
+    snprintf(line, sizeof(line), "  front end %.0f%%, rename %.0f%%, regs %.0f%%, window %.0f%%, FUs %.0f%%, memory %.0f%%",
+             share[0], share[1], share[2], share[3], share[4], share[5]);
+    cpu_print(cpu, "| %-75s |\n", line);
+    snprintf(line, sizeof(line), "Data memory: %lld pages (%lld KB) of %d, %lld faults",
+             cpu->stats.pagesAllocated, cpu->stats.pagesAllocated * PAGE_WORDS * 4 / 1024, cpu->frameCount,
+             cpu->stats.memFaults);
+    cpu_print(cpu, "| %-75s |\n", line);
+    cpu_print(cpu, "+-----------------------------------------------------------------------------+\n\n");
+}
+
+static void sample_occupancy(ApexCpu* cpu) {
+    int busy = 0;
+    for(int i=0; i<INT_RS_SIZE; i++) busy += cpu->intRs[i].busy;
+    for(int i=0; i<MUL_RS_SIZE; i++) busy += cpu->mulRs[i].busy;
+    cpu->stats.robOccupancy += cpu->robCount;
+    cpu->stats.rsOccupancy += busy;
+    cpu->stats.lsqOccupancy += cpu->lsqCount;
+}
+
+// --------------------------------------------------------------------
+// CYCLE KERNELS
+// --------------------------------------------------------------------
+// One cycle of every stage, in reverse pipeline order so each stage sees
+// the latches as the previous cycle left them
+static ALWAYS_INLINE void cycle_stages(ApexCpu* cpu, KernelSpec spec) {
+    cpu->wasFlushed = FALSE;
+    cpu->wasStalled = FALSE;
+    data_forwarding(cpu, spec);
+    commitRob(cpu, spec);
+    execute_mau(cpu, spec);
+    if(spec.extras) store_buffer_drain(cpu, spec);
+    execute_mul_fu(cpu);
+    execute_int_fu(cpu, spec);
+    if(spec.extras && cpu->config.earlyResolve) resolve_branches(cpu, spec);
+    instructionIssue(cpu, spec);
+    rename_2_dispatch(cpu, spec);
+    decode_rename_1(cpu, spec);
+    fetch_stage_2(cpu);
+    fetch_stage_1(cpu, spec);
+    sample_occupancy(cpu);
+}
+
+#define CYCLE_KERNEL(name, predictor, timedFetch, timedData) \
+    static void name(ApexCpu* cpu) { cycle_stages(cpu, (KernelSpec){predictor, timedFetch, timedData, FALSE}); }
+
+CYCLE_KERNEL(kernel_ideal, FALSE, FALSE, FALSE)
+CYCLE_KERNEL(kernel_ideal_pred, TRUE, FALSE, FALSE)
+CYCLE_KERNEL(kernel_fetch, FALSE, TRUE, FALSE)
+CYCLE_KERNEL(kernel_fetch_pred, TRUE, TRUE, FALSE)
+CYCLE_KERNEL(kernel_data, FALSE, FALSE, TRUE)
+CYCLE_KERNEL(kernel_data_pred, TRUE, FALSE, TRUE)
+CYCLE_KERNEL(kernel_timed, FALSE, TRUE, TRUE)
+CYCLE_KERNEL(kernel_timed_pred, TRUE, TRUE, TRUE)
+
+static void kernel_generic(ApexCpu* cpu) {
+    cycle_stages(cpu, (KernelSpec){cpu->predictor_enabled, TRUE, TRUE, TRUE});
+}
+
+typedef void (*CycleKernel)(ApexCpu* cpu);
+
+// [timed fetch][timed data][predictor]
+static const CycleKernel specializedKernels[2][2][2] = {
+    {{kernel_ideal, kernel_ideal_pred}, {kernel_data, kernel_data_pred}},
+    {{kernel_fetch, kernel_fetch_pred}, {kernel_timed, kernel_timed_pred}},
+};
+
+// Picks the kernels for the current configuration, one per predictor
+// setting since main and embedders flip predictor_enabled directly.
+// Configurations using an optional feature run the generic kernel.
+static void select_kernels(ApexCpu* cpu) {
+    const ApexConfig* c = &cpu->config;
+    int extras = c->fusion || c->lsdSize > 0 || c->valuePred != VP_OFF || c->robWalk ||
+                 c->prfReadPorts > 0 || c->prfWritePorts > 0 || c->bypass != BYPASS_FULL || c->wakeupDelay > 0 ||
+                 c->storeBuffer > 0 || c->earlyResolve;
+    int timedFetch = cpu->icacheSets > 0 || c->itlbEntries > 0;
+    int timedData = c->dtlbEntries > 0;
+    for(int p=0; p<2; p++) {
+        cpu->cycleKernel[p] = (c->specialize && !extras) ? specializedKernels[timedFetch][timedData][p] : kernel_generic;
+    }
+}
+
+// --------------------------------------------------------------------
+// IDLE-CYCLE SKIPPING
+// --------------------------------------------------------------------
+// Some reservation station entry would issue (or pick up its flags) this cycle
+static int rs_can_issue(ApexCpu* cpu) {
+    for(int k=0; k<INT_RS_SIZE; k++) {
+        Instruction* i = cpu->intRs[k].instr;
+        if(!cpu->intRs[k].busy || !i->rs1Ready || !i->rs2Ready) continue;
+        if(!needs_flags(i->opcode) || i->flagsReady) return TRUE;
+        if(i->physSrcCc != -1 && bitmap_test(&cpu->cprfValid, i->physSrcCc)) return TRUE;
+    }
+    for(int k=0; k<MUL_RS_SIZE; k++) {
+        Instruction* i = cpu->mulRs[k].instr;
+        if(cpu->mulRs[k].busy && i->rs1Ready && i->rs2Ready) return TRUE;
+    }
+    return FALSE;
+}
+
+// Counts the cycles from now, up to limit, in which no stage can change
+// machine state: nothing completes, issues, dispatches or decodes, and
+// fetch is held. Such cycles differ only in stall counters and in the
+// countdowns (page walk, recovery, redirect, fetch miss) bounding the count.
+static int idle_cycles(ApexCpu* cpu, int limit, long long** stallCounter) {
+    *stallCounter = NULL;
+    if(cpu->simulationHalted || cpu->forwardingCount > 0 || cpu->sbCount > 0) return 0;
+    if(cpu->intFuLatch || cpu->mulFuLatch) return 0;
+    for(int j=0; j<3; j++) if(cpu->mulPipeline[j]) return 0;
+    if(cpu->robCount > 0 && cpu->rob[cpu->robHead].status == 1) return 0;
+    if(cpu->mauWalkCycles > 0) {
+        if(limit > cpu->mauWalkCycles) limit = cpu->mauWalkCycles;
+    } else if(cpu->mauPipeline[0] || lsq_head_ready(cpu)) {
+        return 0;
+    }
+    if(rs_can_issue(cpu)) return 0;
+    if(cpu->dispatchLatch && !dispatch_blocked(cpu, cpu->dispatchLatch)) return 0;
+    if(cpu->fetch2Latch && !cpu->dispatchLatch) {
+        if(cpu->clock >= cpu->renameResumeCycle) return 0;
+        if(limit > cpu->renameResumeCycle - cpu->clock) limit = cpu->renameResumeCycle - cpu->clock;
+    }
+    if(cpu->fetch1Latch) return cpu->fetch2Latch ? limit : 0;
+    if(cpu->fetchStalled) return limit;
+    if(cpu->lsd.active) return (cpu->fetch2Latch && cpu->lsd.codeVersion == cpu->codeVersion) ? limit : 0;
+    if(code_index(cpu->pc) < 0) return limit;
+    if(cpu->clock < cpu->redirectReadyCycle) {
+        *stallCounter = &cpu->stats.redirectStallCycles;
+        return (limit < cpu->redirectReadyCycle - cpu->clock) ? limit : cpu->redirectReadyCycle - cpu->clock;
+    }
+    if(cpu->fetchMissPc == cpu->pc && cpu->clock < cpu->fetchReadyCycle) {
+        *stallCounter = &cpu->stats.fetchStallCycles;
+        return (limit < cpu->fetchReadyCycle - cpu->clock) ? limit : cpu->fetchReadyCycle - cpu->clock;
+    }
+    return 0;
+}
+
+// Advances the clock over n idle cycles, adding what each would have counted
+static void skip_idle(ApexCpu* cpu, int n, long long* stallCounter) {
+    cpu->profFrames[cpu->profFrame].cycles += n;
+    if(cpu->robCount > 0) cpu->pcProfile[code_index(cpu->rob[cpu->robHead].instr->pc)].headCycles += n;
+    if(cpu->mauWalkCycles > 0) {
+        cpu->mauWalkCycles -= n;
+        cpu->stats.pageWalkCycles += n;
+    }
+    if(stallCounter) *stallCounter += n;
+    int busy = 0;
+    for(int i=0; i<INT_RS_SIZE; i++) busy += cpu->intRs[i].busy;
+    for(int i=0; i<MUL_RS_SIZE; i++) busy += cpu->mulRs[i].busy;
+    cpu->stats.robOccupancy += (long long)n * cpu->robCount;
+    cpu->stats.rsOccupancy += (long long)n * busy;
+    cpu->stats.lsqOccupancy += (long long)n * cpu->lsqCount;
+    cpu->wasFlushed = FALSE;
+    cpu->wasStalled = TRUE;     // every idle case holds fetch
+    cpu->clock += n;
+}
+
+// Simulates one cycle, or skips a run of idle cycles when that is
+// indistinguishable from stepping: no per-cycle hook is watching and the
+// budget allows. A skip never passes the next sample. Returns the cycles
+// consumed.
+static long long simulate_or_skip(ApexCpu* cpu, long long budget) {
+    if(cpu->config.idleSkip && !cpu->hooks[APEX_HOOK_CYCLE].fn && cpu->clock < cpu->config.maxCycles) {
+        long long limit = cpu->config.maxCycles - cpu->clock;
+        if(limit > budget) limit = budget;
+        if(cpu->sampleFn && limit > cpu->nextSample - cpu->clock) limit = cpu->nextSample - cpu->clock;
+        long long* stallCounter;
+        int n = idle_cycles(cpu, (int)limit, &stallCounter);
+        if(n > 0) {
+            skip_idle(cpu, n, stallCounter);
+            return n;
+        }
+    }
+    cpu_simulate_cycle(cpu);
+    return 1;
+}
+
+static inline void cpu_sample(ApexCpu* cpu) {
+    if(cpu->sampleFn && cpu->clock >= cpu->nextSample) {
+        cpu->nextSample = (cpu->clock / cpu->sampleInterval + 1) * cpu->sampleInterval;
+        cpu->sampleFn(cpu, cpu->sampleUser);
+    }
 }
 
 void cpu_simulate_cycle(ApexCpu* cpu) {
-    if (cpu->clock >= MAX_CYCLES) {
-        printf("\n*** Max Cycles (%d) Reached. Force Stopping. ***\n", MAX_CYCLES);
+    if (cpu->clock >= cpu->config.maxCycles) {
+        cpu_log(cpu, APEX_LOG_WARN, "\n*** Max Cycles (%d) Reached. Force Stopping. ***\n", cpu->config.maxCycles);
         cpu->simulationHalted = 1;
         return;
     }
 
     if (cpu->simulationHalted && cpu->robCount == 0) return;
-    cpu->wasFlushed = FALSE;
-    cpu->wasStalled = FALSE;
-    data_forwarding(cpu);
-    commitRob(cpu);
-    execute_mau(cpu);
-    execute_mul_fu(cpu);
-    execute_int_fu(cpu);
-    instructionIssue(cpu);
-    rename_2_dispatch(cpu); 
-    decode_rename_1(cpu);   
-    fetch_stage_2(cpu);     
-    fetch_stage_1(cpu);     
+    if (!cpu->cycleKernel[0]) select_kernels(cpu);
+    cpu->cycleKernel[cpu->predictor_enabled != 0](cpu);
     cpu->clock++;
-}
\ No newline at end of file
+    cpu_hook(cpu, APEX_HOOK_CYCLE, NULL);
+}
+
+// --------------------------------------------------------------------
+// PROFILER OUTPUT
+// --------------------------------------------------------------------
+// Annotated listing: every line of the program source, with the profile
+// of the instruction it assembled to.
+int cpu_profile_listing(ApexCpu* cpu, const char* sourcePath, FILE* out) {
+    FILE* src = fopen(sourcePath, "r");
+    if(!src) return FALSE;
+    // .org can place code out of source order, so map lines to code slots
+    int lastLine = 0;
+    for(int k=0; k<CODE_MEMORY_SIZE; k++) if(cpu->codeSourceLine[k] > lastLine) lastLine = cpu->codeSourceLine[k];
+    int* lineSlot = (int*)malloc((lastLine + 1) * sizeof(int));
+    if(!lineSlot) { fclose(src); return FALSE; }
+    for(int k=0; k<=lastLine; k++) lineSlot[k] = -1;
+    for(int k=0; k<CODE_MEMORY_SIZE; k++) if(cpu->codeSourceLine[k] > 0) lineSlot[cpu->codeSourceLine[k]] = k;
+    fprintf(out, "%9s %9s %8s %9s %7s %7s %7s %7s  %-5s %s\n",
+            "executed", "cyc/inst", "at-head", "mispred", "ld-lat", "f-miss", "dtlb", "%cyc", "PC", "source");
+    char line[256];
+    int lineNo = 0;
+    while(fgets(line, sizeof(line), src)) {
+        lineNo++;
+        line[strcspn(line, "\n")] = '\0';
+        int idx = (lineNo <= lastLine) ? lineSlot[lineNo] : -1;
+        if(idx >= 0) {
+            PcProfile* p = &cpu->pcProfile[idx];
+            fprintf(out, "%9lld %9.2f %8lld %9lld %7.2f %7lld %7lld %6.2f%%  %-5d %s\n",
+                    p->executed, p->executed ? (double)p->inflightCycles / p->executed : 0.0, p->headCycles,
+                    cpu->branchStats[idx].mispredicts, p->executed ? (double)p->loadCycles / p->executed : 0.0,
+                    p->fetchMisses, p->dtlbMisses, cpu->clock ? 100.0 * p->headCycles / cpu->clock : 0.0,
+                    4000 + idx * 4, line);
+        } else {
+            fprintf(out, "%77s %s\n", "", line);
+        }
+    }
+    free(lineSlot);
+    fclose(src);
+    return TRUE;
+}
+
+static void fold_frame_name(ApexCpu* cpu, int f, FILE* out) {
+    if(f == 0) { fputs("main", out); return; }
+    fold_frame_name(cpu, cpu->profFrames[f].parent, out);
+    fprintf(out, ";fn_%d", cpu->profFrames[f].entryPc);
+}
+
+// Folded stacks (flamegraph.pl input): one line per call path with the
+// cycles spent in it, attributed by the call path at commit.
+int cpu_profile_folded(ApexCpu* cpu, FILE* out) {
+    for(int f=0; f<cpu->profFrameCount; f++) {
+        if(cpu->profFrames[f].cycles == 0) continue;
+        fold_frame_name(cpu, f, out);
+        fprintf(out, " %lld\n", cpu->profFrames[f].cycles);
+    }
+    return TRUE;
+}
+
+// --------------------------------------------------------------------
+// EMBEDDING API
+// --------------------------------------------------------------------
+ApexCpu* cpu_create(const ApexConfig* cfg) {
+    ApexCpu* cpu = (ApexCpu*)malloc(sizeof(ApexCpu));
+    if(!cpu) return NULL;
+    cpu_init(cpu);
+    if(cfg && !cpu_configure(cpu, cfg)) {
+        cpu_destroy(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+void cpu_destroy(ApexCpu* cpu) {
+    if(!cpu) return;
+    cpu_release(cpu);
+    free(cpu);
+}
+
+// Pairs each in-flight instruction of the source CPU with its copy, so an
+// instruction shared by the ROB, a reservation station and a latch stays
+// shared in the clone
+#define CLONE_MAX_INSTRS (ROB_SIZE + 16)
+
+typedef struct {
+    const Instruction* from[CLONE_MAX_INSTRS];
+    Instruction* to[CLONE_MAX_INSTRS];
+    int count;
+    int failed;
+} InstrMap;
+
+static Instruction* clone_instr(InstrMap* m, const Instruction* from) {
+    if(!from || m->failed) return NULL;
+    for(int k=0; k<m->count; k++) if(m->from[k] == from) return m->to[k];
+    Instruction* to = (m->count < CLONE_MAX_INSTRS) ? (Instruction*)malloc(sizeof(Instruction)) : NULL;
+    if(!to) {
+        m->failed = TRUE;
+        return NULL;
+    }
+    *to = *from;
+    m->from[m->count] = from;
+    m->to[m->count++] = to;
+    return to;
+}
+
+// Deep copy: data memory, in-flight instructions and all predictor and
+// cache state, so the copy runs on cycle-for-cycle exactly like the
+// original. Translated fast-forward blocks are rebuilt on demand rather
+// than copied. Returns NULL when out of host memory.
+ApexCpu* cpu_clone(const ApexCpu* cpu) {
+    ApexCpu* copy = (ApexCpu*)malloc(sizeof(ApexCpu));
+    if(!copy) return NULL;
+    *copy = *cpu;
+    copy->instrPoolCount = 0;
+    memset(copy->blockCache, 0, sizeof(copy->blockCache));
+    memset(copy->pageTable, 0, sizeof(copy->pageTable));
+    copy->framesUsed = 0;
+    copy->frames = (int**)calloc(cpu->frameCount, sizeof(int*));
+    int ok = (copy->frames != NULL);
+    for(int i=0; ok && i<PT_ENTRIES; i++) {
+        if(!cpu->pageTable[i]) continue;
+        copy->pageTable[i] = (int*)malloc(PT_ENTRIES * sizeof(int));
+        ok = (copy->pageTable[i] != NULL);
+        if(ok) memcpy(copy->pageTable[i], cpu->pageTable[i], PT_ENTRIES * sizeof(int));
+    }
+    for(int i=0; ok && i<cpu->framesUsed; i++) {
+        copy->frames[i] = (int*)malloc(PAGE_WORDS * sizeof(int));
+        ok = (copy->frames[i] != NULL);
+        if(ok) {
+            memcpy(copy->frames[i], cpu->frames[i], PAGE_WORDS * sizeof(int));
+            copy->framesUsed++;
+        }
+    }
+
+    // Only live slots are followed; free ROB, RS and LSQ slots may still
+    // point at recycled instructions
+    InstrMap map;
+    map.count = 0;
+    map.failed = !ok;
+    for(int k=0, e=cpu->robHead; k<cpu->robCount; k++, e=(e + 1) % ROB_SIZE) {
+        copy->rob[e].instr = clone_instr(&map, cpu->rob[e].instr);
+    }
+    for(int i=0; i<INT_RS_SIZE; i++) copy->intRs[i].instr = cpu->intRs[i].busy ? clone_instr(&map, cpu->intRs[i].instr) : NULL;
+    for(int i=0; i<MUL_RS_SIZE; i++) copy->mulRs[i].instr = cpu->mulRs[i].busy ? clone_instr(&map, cpu->mulRs[i].instr) : NULL;
+    for(int i=0; i<LSQ_SIZE; i++) copy->lsq[i].instr = cpu->lsq[i].allocated ? clone_instr(&map, cpu->lsq[i].instr) : NULL;
+    copy->fetch1Latch = clone_instr(&map, cpu->fetch1Latch);
+    copy->fetch2Latch = clone_instr(&map, cpu->fetch2Latch);
+    copy->dispatchLatch = clone_instr(&map, cpu->dispatchLatch);
+    copy->intFuLatch = clone_instr(&map, cpu->intFuLatch);
+    copy->mulFuLatch = clone_instr(&map, cpu->mulFuLatch);
+    for(int i=0; i<3; i++) copy->mulPipeline[i] = clone_instr(&map, cpu->mulPipeline[i]);
+    // MAU stage 2 is occupied only inside execute_mau, never between cycles
+    copy->mauPipeline[0] = clone_instr(&map, cpu->mauPipeline[0]);
+    copy->mauPipeline[1] = NULL;
+    if(map.failed) {
+        for(int k=0; k<map.count; k++) free(map.to[k]);
+        copy->robCount = 0;
+        copy->fetch1Latch = copy->fetch2Latch = copy->dispatchLatch = NULL;
+        cpu_destroy(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+int cpu_load_memory_words(ApexCpu* cpu, unsigned int base, const int* words, int count) {
+    sb_flush(cpu);
+    return mem_write_block(cpu, base, words, count);
+}
+
+// Simulates up to cycles cycles, stopping early once the CPU halts or the
+// debugger stops it. Returns the number of cycles simulated.
+long long cpu_step(ApexCpu* cpu, long long cycles) {
+    long long done = 0;
+    if(cpu->debug) cpu->debug->stop = APEX_STOP_NONE;
+    while(done < cycles && !cpu->simulationHalted && !cpu_stopped(cpu)) {
+        done += simulate_or_skip(cpu, cycles - done);
+        cpu_sample(cpu);
+    }
+    return done;
+}
+
+// Simulates until done() returns true, the CPU halts, the debugger stops
+// it or maxCycles pass (0 = no limit). done() is checked before every cycle.
+long long cpu_run_until(ApexCpu* cpu, ApexPredicate done, void* user, long long maxCycles) {
+    long long cycles = 0;
+    if(cpu->debug) cpu->debug->stop = APEX_STOP_NONE;
+    while(!cpu->simulationHalted && !cpu_stopped(cpu) && (maxCycles <= 0 || cycles < maxCycles)) {
+        if(done && done(cpu, user)) break;
+        // The predicate must see every cycle, so only an unconditioned run skips
+        if(done) {
+            cpu_simulate_cycle(cpu);
+            cycles++;
+        } else {
+            cycles += simulate_or_skip(cpu, (maxCycles > 0) ? maxCycles - cycles : INT_MAX);
+        }
+        cpu_sample(cpu);
+    }
+    return cycles;
+}
+
+void cpu_set_logger(ApexCpu* cpu, ApexLogFn fn, void* user, int level) {
+    cpu->logFn = fn;
+    cpu->logUser = user;
+    cpu->logLevel = level;
+}
+
+void cpu_set_hook(ApexCpu* cpu, ApexHookEvent event, ApexHookFn fn, void* user) {
+    if(event < 0 || event >= APEX_HOOK_COUNT) return;
+    cpu->hooks[event].fn = fn;
+    cpu->hooks[event].user = user;
+}
+
+// Calls fn from cpu_step() and cpu_run_until() each time the clock reaches
+// a multiple of interval. Unlike a CYCLE hook it leaves idle-cycle
+// skipping on. fn = NULL removes the sampler.
+void cpu_set_sampler(ApexCpu* cpu, int interval, ApexSampleFn fn, void* user) {
+    cpu->sampleFn = (interval > 0) ? fn : NULL;
+    cpu->sampleUser = user;
+    cpu->sampleInterval = interval;
+    if(cpu->sampleFn) cpu->nextSample = (cpu->clock / interval + 1) * interval;
+}
+
+const ApexStats* cpu_stats(const ApexCpu* cpu) { return &cpu->stats; }
+
+// Dynamic energy of the run so far: access counts times the configured
+// per-access energies, with power and EDP over the modeled run time
+void cpu_energy(const ApexCpu* cpu, ApexEnergy* out) {
+    memset(out, 0, sizeof(ApexEnergy));
+    for(int k=0; k<ACC_COUNT; k++) {
+        out->accessNj[k] = cpu->stats.accesses[k] * (double)cpu->config.energy[k] * 1e-6;
+        out->dynamicNj += out->accessNj[k];
+    }
+    out->seconds = cpu->clock / (cpu->config.clockMhz * 1e6);
+    out->averageMw = out->seconds > 0 ? out->dynamicNj * 1e-6 / out->seconds : 0.0;
+    out->edp = out->dynamicNj * 1e-9 * out->seconds;
+}
+int cpu_cycles(const ApexCpu* cpu) { return cpu->clock; }
+int cpu_retired(const ApexCpu* cpu) { return cpu->instructionsRetired; }
+int cpu_halted(const ApexCpu* cpu) { return cpu->simulationHalted; }
+
+int cpu_read_reg(const ApexCpu* cpu, int reg) {
+    return (reg >= 0 && reg < ARCH_REG_FILE_SIZE) ? cpu->arf[reg] : 0;
+}
+
+int cpu_read_memory(ApexCpu* cpu, unsigned int addr, int* value) {
+    return mem_read_buffered(cpu, addr, value);
+}
+
+void cpu_set_debugger(ApexCpu* cpu, ApexDebug* debug) { cpu->debug = debug; }
+int cpu_stopped(const ApexCpu* cpu) { return cpu->debug && cpu->debug->stop != APEX_STOP_NONE; }
+
+void apex_debug_init(ApexDebug* d) {
+    memset(d, 0, sizeof(ApexDebug));
+    d->condReg = -1;
+}
+
+static void debug_update(ApexDebug* d) {
+    int breaks = 0;
+    for(int w=0; w<BITMAP_WORDS(CODE_MEMORY_SIZE); w++) breaks |= (d->breakMap[w] != 0);
+    d->commitChecks = breaks || d->untilRetired > 0 || d->condReg != -1;
+}
+
+// Returns FALSE when pc is not a code address
+int apex_debug_set_break(ApexDebug* d, int pc, int on) {
+    int idx = code_index(pc);
+    if(idx < 0) return FALSE;
+    if(on) d->breakMap[idx >> 6] |= 1ULL << (idx & 63);
+    else d->breakMap[idx >> 6] &= ~(1ULL << (idx & 63));
+    debug_update(d);
+    return TRUE;
+}
+
+// Returns FALSE when adding to a full watch list
+int apex_debug_set_watch(ApexDebug* d, unsigned int addr, int on) {
+    int k = 0;
+    while(k < d->watchCount && d->watchAddr[k] != addr) k++;
+    if(on && k == d->watchCount) {
+        if(d->watchCount == DEBUG_MAX_WATCHES) return FALSE;
+        d->watchAddr[d->watchCount++] = addr;
+    } else if(!on && k < d->watchCount) {
+        d->watchAddr[k] = d->watchAddr[--d->watchCount];
+    }
+    memset(d->watchPages, 0, sizeof(d->watchPages));
+    for(int j=0; j<d->watchCount; j++) {
+        int bit = watch_page_bit(d->watchAddr[j]);
+        d->watchPages[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    return TRUE;
+}
+
+// Stops once retired instructions have retired in total (0 = off), or
+// once a retiring write to reg (-1 = off) makes "reg op value" true
+void apex_debug_set_until(ApexDebug* d, long long retired, int reg, ApexCondOp op, int value) {
+    d->untilRetired = retired;
+    d->condReg = (reg >= 0 && reg < ARCH_REG_FILE_SIZE) ? reg : -1;
+    d->condOp = op;
+    d->condValue = value;
+    debug_update(d);
+}
+
+int apex_debug_cond_holds(const ApexDebug* d, int value) {
+    switch(d->condOp) {
+        case APEX_COND_EQ: return value == d->condValue;
+        case APEX_COND_NE: return value != d->condValue;
+        case APEX_COND_LT: return value < d->condValue;
+        case APEX_COND_LE: return value <= d->condValue;
+        case APEX_COND_GT: return value > d->condValue;
+        case APEX_COND_GE: return value >= d->condValue;
+    }
+    return FALSE;
+}
+
+// --------------------------------------------------------------------
+// FUNCTIONAL FAST-FORWARD
+// --------------------------------------------------------------------
+// Executes instructions architecturally with no timing. Basic blocks are
+// translated once into arrays of pre-bound handlers with register operands
+// resolved to ffRegs slots. Each handler returns the next op, so a block
+// exit can continue straight into the successor it is linked to; a flag
+// setter is fused with the branch closing its block, and flags nothing
+// observes are not computed. The switch interpreter below is the reference
+// and also finishes blocks that would overrun the instruction budget.
+#define FF_ZERO ARCH_REG_FILE_SIZE       // always reads 0 (missing operand)
+#define FF_SINK (ARCH_REG_FILE_SIZE + 1) // absorbs writes to a missing rd
+
+#define FF_RUNNING 0
+#define FF_HALTED 1
+#define FF_FAULT 2
+#define FF_BAD_PC 3
+
+typedef struct TransOp TransOp;
+typedef struct TransBlock TransBlock;
+
+// A handler returns the next op to run: the following op, the first op of
+// a linked successor block, or NULL to return to the dispatch loop
+typedef TransOp* (*TransHandler)(ApexCpu* cpu, TransOp* op);
+
+struct TransOp {
+    TransHandler run;
+    int rd, rs1, rs2;
+    int imm;            // immediate, or the resolved target of a control op
+    int pc;
+    int left;           // ops after this one in the block
+    TransBlock* link[2];    // successor last seen at each exit: not taken, taken
+};
+
+// ops[count] is a sentinel that leaves a block ending without a control op
+struct TransBlock {
+    int pc;
+    int count;
+    TransOp ops[];
+};
+
+static inline int ff_flags(int result) {
+    return (result == 0) | ((result > 0) << 1) | ((result < 0) << 2);
+}
+
+static void ff_memory_fault(ApexCpu* cpu, int pc, unsigned int addr, int status) {
+    cpu->stats.memFaults++;
+    cpu_log(cpu, APEX_LOG_ERROR, "*** Memory fault: fast-forward at PC %d, address %u (%s) ***\n", pc, addr, mem_fault_name(status));
+    if(cpu->config.memFaultTrap) cpu->ffStop = FF_FAULT;
+}
+
+// Leaves the block for pc. The successor is entered directly when the
+// link from this exit already points at it and it fits in the budget;
+// otherwise the dispatch loop looks it up and fills in the link.
+static inline TransOp* ff_exit(ApexCpu* cpu, TransOp* op, int slot, int pc) {
+    TransBlock* next = op->link[slot];
+    if(next && next->pc == pc && next->count <= cpu->ffBudget) {
+        cpu->ffBudget -= next->count;
+        return next->ops;
+    }
+    cpu->ffNextPc = pc;
+    cpu->ffLink = &op->link[slot];
+    return NULL;
+}
+
+// Stops at op, which counts as executed; the rest of the block does not
+static TransOp* ff_stop(ApexCpu* cpu, TransOp* op) {
+    cpu->ffBudget += op->left;
+    cpu->ffNextPc = op->pc;
+    return NULL;
+}
+
+// Loads and stores remember the pages they touch, so that repeated
+// accesses skip the page-table walk and the memLimit check. Only pages
+// wholly inside memLimit are remembered. Reads of an unmapped page see
+// ffZeroPage, which is never written: stores go through ffWritePages, and
+// mapping a page replaces its read slot.
+static int ffZeroPage[PAGE_WORDS];
+
+static inline int* ff_page_word(FfPageSlot* pages, unsigned int addr) {
+    FfPageSlot* slot = &pages[(addr >> PAGE_SHIFT) & (FF_PAGE_SLOTS - 1)];
+    return (slot->vpn == addr >> PAGE_SHIFT) ? &slot->words[addr & (PAGE_WORDS - 1)] : NULL;
+}
+
+static void ff_page_remember(ApexCpu* cpu, FfPageSlot* pages, unsigned int addr, int* page) {
+    unsigned int base = addr & ~(unsigned int)(PAGE_WORDS - 1);
+    if(cpu->config.memLimit > 0 && base + PAGE_WORDS > (unsigned int)cpu->config.memLimit) return;
+    FfPageSlot* slot = &pages[(addr >> PAGE_SHIFT) & (FF_PAGE_SLOTS - 1)];
+    slot->vpn = addr >> PAGE_SHIFT;
+    slot->words = page;
+}
+
+#define FF_ALU(name, expr, setsFlags) \
+    static TransOp* ff_##name(ApexCpu* cpu, TransOp* op) { \
+        int* r = cpu->ffRegs; \
+        int result = (expr); \
+        r[op->rd] = result; \
+        if(setsFlags) cpu->ffFlags = ff_flags(result); \
+        return op + 1; \
+    }
+
+FF_ALU(add, r[op->rs1] + r[op->rs2], TRUE)
+FF_ALU(addl, r[op->rs1] + op->imm, TRUE)
+FF_ALU(sub, r[op->rs1] - r[op->rs2], TRUE)
+FF_ALU(subl, r[op->rs1] - op->imm, TRUE)
+FF_ALU(mul, r[op->rs1] * r[op->rs2], TRUE)
+FF_ALU(and, r[op->rs1] & r[op->rs2], TRUE)
+FF_ALU(or, r[op->rs1] | r[op->rs2], FALSE)
+FF_ALU(xor, r[op->rs1] ^ r[op->rs2], FALSE)
+FF_ALU(movc, op->imm, FALSE)
+
+// The same operations where a later op in the block sets the flags again
+// before anything can observe them
+FF_ALU(add_nf, r[op->rs1] + r[op->rs2], FALSE)
+FF_ALU(addl_nf, r[op->rs1] + op->imm, FALSE)
+FF_ALU(sub_nf, r[op->rs1] - r[op->rs2], FALSE)
+FF_ALU(subl_nf, r[op->rs1] - op->imm, FALSE)
+FF_ALU(mul_nf, r[op->rs1] * r[op->rs2], FALSE)
+FF_ALU(and_nf, r[op->rs1] & r[op->rs2], FALSE)
+
+static TransOp* ff_cmp(ApexCpu* cpu, TransOp* op) {
+    cpu->ffFlags = ff_flags(cpu->ffRegs[op->rs1] - cpu->ffRegs[op->rs2]);
+    return op + 1;
+}
+static TransOp* ff_cml(ApexCpu* cpu, TransOp* op) {
+    cpu->ffFlags = ff_flags(cpu->ffRegs[op->rs1] - op->imm);
+    return op + 1;
+}
+static TransOp* ff_load(ApexCpu* cpu, TransOp* op) {
+    unsigned int addr = cpu->ffRegs[op->rs1] + op->imm;
+    int* word = ff_page_word(cpu->ffReadPages, addr);
+    if(word) {
+        cpu->ffRegs[op->rd] = *word;
+        return op + 1;
+    }
+    int status = mem_word(cpu, addr, FALSE, &word);
+    cpu->ffRegs[op->rd] = word ? *word : 0;
+    if(status != MEM_OK) {
+        ff_memory_fault(cpu, op->pc, addr, status);
+        return (cpu->ffStop != FF_RUNNING) ? ff_stop(cpu, op) : op + 1;
+    }
+    ff_page_remember(cpu, cpu->ffReadPages, addr, word ? word - (addr & (PAGE_WORDS - 1)) : ffZeroPage);
+    return op + 1;
+}
+static TransOp* ff_store(ApexCpu* cpu, TransOp* op) {
+    unsigned int addr = cpu->ffRegs[op->rs2] + op->imm;
+    int* word = ff_page_word(cpu->ffWritePages, addr);
+    if(word) {
+        *word = cpu->ffRegs[op->rs1];
+        return op + 1;
+    }
+    int status = mem_word(cpu, addr, TRUE, &word);
+    if(word) *word = cpu->ffRegs[op->rs1];
+    if(status != MEM_OK) {
+        ff_memory_fault(cpu, op->pc, addr, status);
+        return (cpu->ffStop != FF_RUNNING) ? ff_stop(cpu, op) : op + 1;
+    }
+    int* page = word - (addr & (PAGE_WORDS - 1));
+    ff_page_remember(cpu, cpu->ffReadPages, addr, page);
+    ff_page_remember(cpu, cpu->ffWritePages, addr, page);
+    return op + 1;
+}
+static TransOp* ff_nop(ApexCpu* cpu, TransOp* op) { (void)cpu; return op + 1; }
+
+static TransOp* ff_bz(ApexCpu* cpu, TransOp* op) {
+    return (cpu->ffFlags & 1) ? ff_exit(cpu, op, 1, op->imm) : ff_exit(cpu, op, 0, op->pc + 4);
+}
+static TransOp* ff_bnz(ApexCpu* cpu, TransOp* op) {
+    return !(cpu->ffFlags & 1) ? ff_exit(cpu, op, 1, op->imm) : ff_exit(cpu, op, 0, op->pc + 4);
+}
+static TransOp* ff_bp(ApexCpu* cpu, TransOp* op) {
+    return (cpu->ffFlags & 2) ? ff_exit(cpu, op, 1, op->imm) : ff_exit(cpu, op, 0, op->pc + 4);
+}
+static TransOp* ff_bn(ApexCpu* cpu, TransOp* op) {
+    return (cpu->ffFlags & 4) ? ff_exit(cpu, op, 1, op->imm) : ff_exit(cpu, op, 0, op->pc + 4);
+}
+static TransOp* ff_jump(ApexCpu* cpu, TransOp* op) { return ff_exit(cpu, op, 0, cpu->ffRegs[op->rs1] + op->imm); }
+static TransOp* ff_call(ApexCpu* cpu, TransOp* op) {
+    cpu->ffRegs[op->rd] = op->pc + 4;
+    return ff_exit(cpu, op, 0, op->imm);
+}
+static TransOp* ff_ret(ApexCpu* cpu, TransOp* op) { return ff_exit(cpu, op, 0, cpu->ffRegs[op->rs1]); }
+static TransOp* ff_halt(ApexCpu* cpu, TransOp* op) {
+    cpu->ffStop = FF_HALTED;
+    return ff_stop(cpu, op);
+}
+static TransOp* ff_block_end(ApexCpu* cpu, TransOp* op) { return ff_exit(cpu, op, 0, op->pc); }
+
+// A flag-setting op and the conditional branch closing its block, run as
+// one handler that tests the result directly. op[1] is the branch.
+#define FF_FUSED(name, expr, taken) \
+    static TransOp* ff_##name(ApexCpu* cpu, TransOp* op) { \
+        int* r = cpu->ffRegs; \
+        int result = (expr); \
+        r[op->rd] = result; \
+        cpu->ffFlags = ff_flags(result); \
+        return (taken) ? ff_exit(cpu, op + 1, 1, op[1].imm) : ff_exit(cpu, op + 1, 0, op[1].pc + 4); \
+    }
+
+#define FF_FUSED_BRANCHES(name, expr) \
+    FF_FUSED(name##_bz, expr, result == 0) \
+    FF_FUSED(name##_bnz, expr, result != 0) \
+    FF_FUSED(name##_bp, expr, result > 0) \
+    FF_FUSED(name##_bn, expr, result < 0)
+
+FF_FUSED_BRANCHES(add, r[op->rs1] + r[op->rs2])
+FF_FUSED_BRANCHES(addl, r[op->rs1] + op->imm)
+FF_FUSED_BRANCHES(sub, r[op->rs1] - r[op->rs2])
+FF_FUSED_BRANCHES(subl, r[op->rs1] - op->imm)
+FF_FUSED_BRANCHES(mul, r[op->rs1] * r[op->rs2])
+FF_FUSED_BRANCHES(and, r[op->rs1] & r[op->rs2])
+FF_FUSED_BRANCHES(cmp, r[op->rs1] - r[op->rs2])
+FF_FUSED_BRANCHES(cml, r[op->rs1] - op->imm)
+
+#define FF_FUSED_ROW(name) {ff_##name##_bz, ff_##name##_bnz, ff_##name##_bp, ff_##name##_bn}
+
+static const TransHandler ffFused[8][4] = {
+    FF_FUSED_ROW(add), FF_FUSED_ROW(addl), FF_FUSED_ROW(sub), FF_FUSED_ROW(subl),
+    FF_FUSED_ROW(mul), FF_FUSED_ROW(and), FF_FUSED_ROW(cmp), FF_FUSED_ROW(cml)
+};
+
+// Returns the fused handler for a flag setter followed by a conditional
+// branch, or NULL if the pair does not fuse
+static TransHandler fused_handler(Opcode setter, Opcode branch) {
+    int row, col;
+    switch(setter) {
+        case OP_ADD: row = 0; break;
+        case OP_ADDL: row = 1; break;
+        case OP_SUB: row = 2; break;
+        case OP_SUBL: row = 3; break;
+        case OP_MUL: row = 4; break;
+        case OP_AND: row = 5; break;
+        case OP_CMP: row = 6; break;
+        case OP_CML: row = 7; break;
+        default: return NULL;
+    }
+    switch(branch) {
+        case OP_BZ: col = 0; break;
+        case OP_BNZ: col = 1; break;
+        case OP_BP: col = 2; break;
+        case OP_BN: col = 3; break;
+        default: return NULL;
+    }
+    return ffFused[row][col];
+}
+
+static int ff_reg(int reg) { return (reg < 0) ? FF_ZERO : reg; }
+
+// Flags are observed by conditional branches, and at any op that can end
+// the run (a load or store may fault), since they are handed back then
+static int observes_flags(Opcode op) {
+    return (op == OP_BZ || op == OP_BNZ || op == OP_BP || op == OP_BN ||
+            op == OP_LOAD || op == OP_STORE || op == OP_HALT);
+}
+
+static TransHandler without_flags(Opcode op) {
+    switch(op) {
+        case OP_ADD: return ff_add_nf;
+        case OP_ADDL: return ff_addl_nf;
+        case OP_SUB: return ff_sub_nf;
+        case OP_SUBL: return ff_subl_nf;
+        case OP_MUL: return ff_mul_nf;
+        case OP_AND: return ff_and_nf;
+        default: return ff_nop;     // CMP, CML
+    }
+}
+
+static int is_block_end(Opcode op) {
+    return (op == OP_BZ || op == OP_BNZ || op == OP_BP || op == OP_BN || op == OP_JUMP ||
+            op == OP_JAL || op == OP_JALP || op == OP_RET || op == OP_HALT);
+}
+
+static void translate_op(TransOp* op, const Instruction* in) {
+    op->pc = in->pc;
+    op->rd = (in->rd < 0) ? FF_SINK : in->rd;
+    op->rs1 = ff_reg(in->rs1);
+    op->rs2 = ff_reg(in->rs2);
+    op->imm = in->imm;
+    switch(in->opcode) {
+        case OP_ADD: op->run = ff_add; break;
+        case OP_ADDL: op->run = ff_addl; break;
+        case OP_SUB: op->run = ff_sub; break;
+        case OP_SUBL: op->run = ff_subl; break;
+        case OP_MUL: op->run = ff_mul; break;
+        case OP_AND: op->run = ff_and; break;
+        case OP_OR: op->run = ff_or; break;
+        case OP_XOR: op->run = ff_xor; break;
+        case OP_MOVC: op->run = ff_movc; break;
+        case OP_CMP: op->run = ff_cmp; break;
+        case OP_CML: op->run = ff_cml; break;
+        case OP_LOAD: op->run = ff_load; break;
+        case OP_STORE: op->run = ff_store; break;
+        case OP_BZ: op->run = ff_bz; op->imm = in->pc + in->imm; break;
+        case OP_BNZ: op->run = ff_bnz; op->imm = in->pc + in->imm; break;
+        case OP_BP: op->run = ff_bp; op->imm = in->pc + in->imm; break;
+        case OP_BN: op->run = ff_bn; op->imm = in->pc + in->imm; break;
+        case OP_JUMP: op->run = ff_jump; break;
+        case OP_JAL: op->run = ff_call; break;  // JAL has no base register
+        case OP_JALP: op->run = ff_call; op->imm = in->pc + in->imm; break;
+        case OP_RET: op->run = ff_ret; break;
+        case OP_HALT: op->run = ff_halt; break;
+        default: op->run = ff_nop; break;
+    }
+}
+
+// Returns the translation of the block starting at pc, building it on a
+// miss. Translations made before the last program load are discarded.
+static TransBlock* lookup_block(ApexCpu* cpu, int pc) {
+    int idx = code_index(pc);
+    if(idx < 0) return NULL;
+    if(cpu->blockCacheVersion != cpu->codeVersion) {
+        for(int i=0; i<CODE_MEMORY_SIZE; i++) { free(cpu->blockCache[i]); cpu->blockCache[i] = NULL; }
+        cpu->blockCacheVersion = cpu->codeVersion;
+    }
+    if(cpu->blockCache[idx]) return cpu->blockCache[idx];
+    int count = 0;
+    while(count < TRANS_MAX_BLOCK && idx + count < CODE_MEMORY_SIZE) {
+        if(is_block_end(cpu->codeMemory[idx + count++].opcode)) break;
+    }
+    TransBlock* b = (TransBlock*)calloc(1, sizeof(TransBlock) + (count + 1) * sizeof(TransOp));
+    b->pc = pc;
+    b->count = count;
+    for(int k=0; k<count; k++) {
+        translate_op(&b->ops[k], &cpu->codeMemory[idx + k]);
+        b->ops[k].left = count - 1 - k;
+    }
+    // Flags are live out of the block; a setter whose flags are overwritten
+    // before being observed skips computing them
+    int flagsLive = TRUE;
+    for(int k=count-1; k>=0; k--) {
+        Opcode opcode = cpu->codeMemory[idx + k].opcode;
+        if(sets_flags(opcode)) {
+            if(!flagsLive) b->ops[k].run = without_flags(opcode);
+            flagsLive = FALSE;
+        }
+        if(observes_flags(opcode)) flagsLive = TRUE;
+    }
+    if(count >= 2) {
+        TransHandler fused = fused_handler(cpu->codeMemory[idx + count - 2].opcode, cpu->codeMemory[idx + count - 1].opcode);
+        if(fused) b->ops[count - 2].run = fused;
+    }
+    b->ops[count].run = ff_block_end;
+    b->ops[count].pc = pc + 4 * count;
+    cpu->blockCache[idx] = b;
+    cpu->stats.ffBlocksTranslated++;
+    return b;
+}
+
+// Reference interpreter: one instruction through a switch on the opcode.
+static void ff_step_switch(ApexCpu* cpu, const Instruction* in) {
+    int* r = cpu->ffRegs;
+    int a = r[ff_reg(in->rs1)], b = r[ff_reg(in->rs2)];
+    int rd = (in->rd < 0) ? FF_SINK : in->rd;
+    unsigned int addr;
+    int status;
+    cpu->ffNextPc = in->pc + 4;
+    switch(in->opcode) {
+        case OP_ADD: r[rd] = a + b; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_ADDL: r[rd] = a + in->imm; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_SUB: r[rd] = a - b; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_SUBL: r[rd] = a - in->imm; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_MUL: r[rd] = a * b; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_AND: r[rd] = a & b; cpu->ffFlags = ff_flags(r[rd]); break;
+        case OP_OR: r[rd] = a | b; break;
+        case OP_XOR: r[rd] = a ^ b; break;
+        case OP_MOVC: r[rd] = in->imm; break;
+        case OP_CMP: cpu->ffFlags = ff_flags(a - b); break;
+        case OP_CML: cpu->ffFlags = ff_flags(a - in->imm); break;
+        case OP_LOAD:
+            addr = a + in->imm;
+            status = mem_read(cpu, addr, &r[rd]);
+            if(status != MEM_OK) ff_memory_fault(cpu, in->pc, addr, status);
+            break;
+        case OP_STORE:
+            addr = b + in->imm;
+            status = mem_write(cpu, addr, a);
+            if(status != MEM_OK) ff_memory_fault(cpu, in->pc, addr, status);
+            break;
+        case OP_BZ: if(cpu->ffFlags & 1) cpu->ffNextPc = in->pc + in->imm; break;
+        case OP_BNZ: if(!(cpu->ffFlags & 1)) cpu->ffNextPc = in->pc + in->imm; break;
+        case OP_BP: if(cpu->ffFlags & 2) cpu->ffNextPc = in->pc + in->imm; break;
+        case OP_BN: if(cpu->ffFlags & 4) cpu->ffNextPc = in->pc + in->imm; break;
+        case OP_JUMP: cpu->ffNextPc = a + in->imm; break;
+        case OP_JAL: r[rd] = in->pc + 4; cpu->ffNextPc = in->imm; break;
+        case OP_JALP: r[rd] = in->pc + 4; cpu->ffNextPc = in->pc + in->imm; break;
+        case OP_RET: cpu->ffNextPc = a; break;
+        case OP_HALT: cpu->ffStop = FF_HALTED; break;
+        default: break;
+    }
+}
+
+// Runs up to count instructions functionally from the current PC. Only
+// legal while nothing is in flight; the rename state is patched afterwards
+// so the timing pipeline can continue from the new architectural state.
+long long cpu_fast_forward(ApexCpu* cpu, long long count) {
+    if(cpu->robCount > 0 || cpu->fetch1Latch || cpu->fetch2Latch || cpu->dispatchLatch) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: fast-forward needs an empty pipeline\n");
+        return -1;
+    }
+    if(cpu->simulationHalted) return 0;
+    sb_flush(cpu);
+    memcpy(cpu->ffRegs, cpu->arf, sizeof(cpu->arf));
+    cpu->ffRegs[FF_ZERO] = 0;
+    cpu->ffFlags = (cpu->ratCc != -1) ? cpu->cprfValue[cpu->ratCc] : 0;
+    cpu->ffStop = FF_RUNNING;
+    cpu->ffBudget = count;
+    cpu->ffLink = NULL;
+    memset(cpu->ffReadPages, 0xff, sizeof(cpu->ffReadPages));
+    memset(cpu->ffWritePages, 0xff, sizeof(cpu->ffWritePages));
+    int pc = cpu->pc;
+    while(cpu->ffBudget > 0 && cpu->ffStop == FF_RUNNING) {
+        TransBlock* b = cpu->config.ffEngine ? lookup_block(cpu, pc) : NULL;
+        if(b && cpu->ffLink) *cpu->ffLink = b;
+        cpu->ffLink = NULL;
+        if(b && b->count <= cpu->ffBudget) {
+            cpu->ffBudget -= b->count;
+            TransOp* op = b->ops;
+            while(op) op = op->run(cpu, op);
+            pc = cpu->ffNextPc;
+        } else {
+            int idx = code_index(pc);
+            if(idx < 0) { cpu->ffStop = FF_BAD_PC; break; }
+            ff_step_switch(cpu, &cpu->codeMemory[idx]);
+            cpu->ffBudget--;
+            if(cpu->ffStop == FF_RUNNING) pc = cpu->ffNextPc;
+        }
+    }
+    long long done = count - cpu->ffBudget;
+    if(cpu->ffStop == FF_HALTED) {
+        done--;  // HALT itself does not retire
+        cpu->simulationHalted = TRUE;
+        cpu_log(cpu, APEX_LOG_INFO, "Simulation Halted by HALT instruction.\n");
+    } else if(cpu->ffStop == FF_FAULT) {
+        done--;
+        cpu->simulationHalted = TRUE;
+    } else if(cpu->ffStop == FF_BAD_PC) {
+        cpu_log(cpu, APEX_LOG_ERROR, "Error: fast-forward reached PC %d outside code memory\n", pc);
+    }
+
+    memcpy(cpu->arf, cpu->ffRegs, sizeof(cpu->arf));
+    cpu->pc = pc;
+    cpu->lsd.active = FALSE;
+    for(int r=0; r<ARCH_REG_FILE_SIZE; r++) {
+        if(cpu->rat[r] != -1) cpu->prfValue[cpu->rat[r]] = cpu->arf[r];
+    }
+    if(done > 0) {
+        if(cpu->ratCc == -1 && !bitmap_is_empty(&cpu->freeListCprf)) {
+            cpu->ratCc = bitmap_take_first(&cpu->freeListCprf);
+            bitmap_set(&cpu->cprfValid, cpu->ratCc);
+        }
+        if(cpu->ratCc != -1) cpu->cprfValue[cpu->ratCc] = cpu->ffFlags;
+    }
+    cpu->stats.ffInstructions += done;
+    return done;
+}
@@ -4,10 +4,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define FALSE 0
 #define TRUE 1
 
+// Bumped whenever a change alters simulated timing or results; cached run
+// results (apex_results) from other versions are ignored
+#define APEX_MODEL_VERSION 2
+
 #define ARCH_REG_FILE_SIZE 32
 #define PHYS_REG_FILE_SIZE 42
 #define CC_REG_FILE_SIZE 28
@@ -16,11 +21,89 @@
 #define INT_RS_SIZE 8
 #define MUL_RS_SIZE 4
 #define LSQ_SIZE 6
-#define BIS_SIZE 8
+#define BIS_SIZE 16  // branch tracking capacity; bis_entries sets the checkpoint budget
 
-#define DATA_MEMORY_SIZE 4096
+#define DATA_MEMORY_SIZE (1 << 20)  // default physical data memory, in words
 #define CODE_MEMORY_SIZE 1024 
 
+// Data addresses are 32-bit word addresses split into 1024-word (4 KB)
+// pages, translated through a two-level page table (11 + 11 bit VPN).
+#define PAGE_SHIFT 10
+#define PAGE_WORDS (1 << PAGE_SHIFT)
+#define PT_LEVEL_BITS 11
+#define PT_ENTRIES (1 << PT_LEVEL_BITS)
+#define PT_LEVELS 2
+
+// Data memory access status
+#define MEM_OK 0
+#define MEM_FAULT_RANGE 1   // address at or beyond mem_limit
+#define MEM_FAULT_FULL 2    // no physical frame left to map the page
+
+#define TRANS_MAX_BLOCK 64  // instructions per translated basic block
+#define FF_PAGE_SLOTS 64    // pages remembered by fast-forward loads and stores
+
+#define PROFILE_MAX_FRAMES 2048  // distinct call paths kept by the profiler
+
+#define VP_MAX_ENTRIES 256
+#define VP_MAX_CONFIDENCE 7
+
+// value_pred modes
+#define VP_OFF 0
+#define VP_LAST_VALUE 1
+#define VP_STRIDE 2
+
+#define LSD_MAX_OPS 32
+#define LSD_LOCK_TRIPS 2        // consecutive taken trips before a loop is captured
+#define INSTR_POOL_SIZE 64      // recycled Instruction objects kept per CPU
+
+// bypass modes: which results a consumer can take off the bypass network
+#define BYPASS_NONE 0
+#define BYPASS_CLUSTER 1    // only from its own cluster (integer + memory, or multiply)
+#define BYPASS_FULL 2
+
+#define CLUSTER_INT 0
+#define CLUSTER_MUL 1
+
+#define STORE_BUFFER_MAX 32
+#define SB_LINE_WORDS 4     // words per store buffer entry; stores to one line combine
+#define SB_COMBINE_CYCLES 4 // a partial line alone in the buffer waits this long for more stores
+
+// Structure accesses counted for the energy model. Indexes
+// ApexStats.accesses and ApexConfig.energy.
+typedef enum {
+    ACC_FETCH,          // instruction fetched through F1
+    ACC_LSD,            // ... or streamed from the loop buffer
+    ACC_BTB,            // lookups and updates
+    ACC_CTP,
+    ACC_TLB,            // ITLB and DTLB lookups
+    ACC_RAT_READ,
+    ACC_RAT_WRITE,
+    ACC_CHECKPOINT,     // rename map and free lists saved or restored
+    ACC_ARF_READ,
+    ACC_ARF_WRITE,
+    ACC_PRF_READ,
+    ACC_PRF_WRITE,
+    ACC_CPRF_READ,
+    ACC_CPRF_WRITE,
+    ACC_RS_WRITE,
+    ACC_RS_COMPARE,     // one wakeup tag compare
+    ACC_RS_READ,
+    ACC_ROB_READ,
+    ACC_ROB_WRITE,
+    ACC_LSQ_WRITE,
+    ACC_LSQ_SEARCH,
+    ACC_SB,             // store buffer insert, lookup or drain
+    ACC_VP,             // value predictor table lookups and updates
+    ACC_ALU,
+    ACC_MUL,
+    ACC_MEM_READ,       // data memory, page table and I-cache fill
+    ACC_MEM_WRITE,
+    ACC_COUNT
+} ApexAccess;
+
+#define ICACHE_MAX_LINES 1024
+#define TLB_MAX_ENTRIES 64
+
 typedef enum {
     OP_ADD, OP_SUB, OP_MUL, OP_AND, OP_OR, OP_XOR,
     OP_ADDL, OP_SUBL, OP_CML, OP_CMP,
@@ -47,18 +130,34 @@ typedef struct Instruction {
     int flagsValue, flagsReady;
     
     int robIndex, lsqIndex, bisIndex;
+    int seq;            // dispatch order; a squash drops everything younger than the branch
+    int fetchCycle;
+    int dispatchCycle;
+    int issueCycle;
     
     int memoryAddress;
     int predictedTaken;
     int predictedTarget;
+    int valueTracked;       // counted in its value predictor entry's in-flight instances
+    int valuePredicted;     // physRd was written with predictedValue at dispatch
+    int predictedValue;
+    int fused;              // conditional branch carrying the compare/ALU op fetched just before it
+    Opcode fusedOp;
+    int fusedPc;
+    int fusedImm;
+    int wokenMask;          // sources (1 rs1, 2 rs2, 4 flags) that arrived by broadcast while waiting
+    int wokenFromMul;       // ... of which the MUL cluster produced
+    int wakeCycle[3];       // cycle each of them arrived
     char predictionInfo[64];
 } Instruction;
 
+// Packed per-register bits (ready, free), sized for the larger register file
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+#define REG_BITMAP_WORDS BITMAP_WORDS(PHYS_REG_FILE_SIZE)
+
 typedef struct {
-    int value;
-    int valid;
-    int allocated;
-} PhysicalRegister;
+    uint64_t bits[REG_BITMAP_WORDS];
+} RegBitmap;
 
 typedef struct {
     Instruction* instr;
@@ -80,6 +179,12 @@ typedef struct {
     int dispatchTime;
 } RsEntry;
 
+// A data page as seen by fast-forward, indexed by the low bits of its number
+typedef struct {
+    unsigned int vpn;       // ~0u = empty
+    int* words;
+} FfPageSlot;
+
 typedef struct {
     int allocated;
     Instruction* instr;
@@ -89,12 +194,14 @@ typedef struct {
     int dataValid;
 } LsqEntry;
 
+// One line of retired stores waiting to be written to data memory
 typedef struct {
-    int items[PHYS_REG_FILE_SIZE + 1]; 
-    int head;
-    int tail;
-    int count;
-} IntQueue;
+    unsigned int line;      // word address / SB_LINE_WORDS
+    int mask;               // words of the line written
+    int draining;           // write started, no more stores combine into it
+    int allocCycle;
+    int words[SB_LINE_WORDS];
+} StoreBufferEntry;
 
 typedef struct {
     int items[16];
@@ -106,8 +213,8 @@ typedef struct {
     int robTailSnapshot;
     int ratSnapshot[ARCH_REG_FILE_SIZE];
     int ratCcSnapshot;
-    IntQueue freeListSnapshot;
-    IntQueue freeListCcSnapshot;
+    RegBitmap freeListSnapshot;
+    RegBitmap freeListCcSnapshot;
 } BisEntry;
 
 typedef struct {
@@ -129,9 +236,231 @@ typedef struct {
     int physRegTag;
     int value;
     int isCc;
+    int seq;        // producer, so a flush can drop only younger results
+    int cluster;
 } ForwardingData;
 
+// Value predictor entry for one load or MUL: its last committed result and
+// the stride between its last two results
+typedef struct {
+    int tagPc;
+    int lastValue;
+    int stride;
+    int confidence;
+    int inflight;           // dispatched instances not yet committed
+} ValuePredEntry;
+
+typedef struct {
+    long long mispredicts;
+    long long squashed;         // instructions thrown away by this branch
+    long long wastedCycles;     // cycles those instructions had spent in flight
+} BranchStats;
+
+// Per-PC profile counters, indexed like codeMemory
+typedef struct {
+    long long executed;         // committed instances
+    long long inflightCycles;   // dispatch to commit, summed over instances
+    long long headCycles;       // cycles spent as the ROB head waiting to commit
+    long long loadCycles;       // loads: issue to data return
+    long long fetchMisses;      // I-cache or ITLB misses fetching this PC
+    long long dtlbMisses;
+} PcProfile;
+
+// One node of the call-path tree: a function (call target) reached
+// through its parent's path. Cycles are self time.
+typedef struct {
+    int parent;
+    int entryPc;
+    long long cycles;
+} ProfileFrame;
+
+// Loop stream detector: a short loop body captured as decoded ops and
+// replayed straight into decode, bypassing the I-cache and both fetch stages
 typedef struct {
+    int active;
+    int branchPc;           // backward branch closing the candidate loop
+    int trips;              // its consecutive predicted-taken trips
+    int startPc;
+    int count;
+    int next;               // op streamed next
+    int codeVersion;
+    Instruction ops[LSD_MAX_OPS];
+} LoopBuffer;
+
+typedef struct {
+    int valid;
+    int tag;
+    int lruTime;
+} CacheLine;
+
+typedef struct {
+    int valid;
+    int vpn;
+    int lruTime;
+} TlbEntry;
+
+struct TransBlock;
+struct ApexCpu;
+
+// Log levels. Messages at or below the CPU's level reach its logger.
+#define APEX_LOG_ERROR 0
+#define APEX_LOG_WARN 1
+#define APEX_LOG_INFO 2
+#define APEX_LOG_DEBUG 3
+
+// Receives formatted text, newline included. With no logger set, text
+// goes to stdout.
+typedef void (*ApexLogFn)(void* user, int level, const char* text);
+
+typedef enum {
+    APEX_HOOK_FETCH,     // instruction entered F1
+    APEX_HOOK_DISPATCH,  // instruction allocated a ROB entry
+    APEX_HOOK_ISSUE,     // instruction left a reservation station
+    APEX_HOOK_COMMIT,    // instruction retired (called before it is freed)
+    APEX_HOOK_FLUSH,     // mispredicted branch squashed younger work
+    APEX_HOOK_CYCLE,     // end of a simulated cycle, instr is NULL
+    APEX_HOOK_COUNT
+} ApexHookEvent;
+
+typedef void (*ApexHookFn)(struct ApexCpu* cpu, ApexHookEvent event, const Instruction* instr, void* user);
+typedef void (*ApexSampleFn)(struct ApexCpu* cpu, void* user);
+typedef int (*ApexPredicate)(const struct ApexCpu* cpu, void* user);
+
+typedef struct {
+    ApexHookFn fn;
+    void* user;
+} ApexHook;
+
+// Debugger stops. Breakpoints are checked as an instruction retires and
+// watchpoints as a store writes memory; either ends the run at the end of
+// that cycle. Watched words are filtered by page through a hashed bitmap,
+// so stores to unwatched pages cost one bit test.
+#define DEBUG_MAX_WATCHES 16
+#define DEBUG_WATCH_BITS 4096
+
+typedef enum {
+    APEX_STOP_NONE,
+    APEX_STOP_BREAK,     // instruction at a breakpoint retired
+    APEX_STOP_WATCH,     // store wrote a watched word
+    APEX_STOP_RETIRED,   // retired count reached untilRetired
+    APEX_STOP_REG        // a retiring write made the register condition true
+} ApexStopReason;
+
+typedef enum { APEX_COND_EQ, APEX_COND_NE, APEX_COND_LT, APEX_COND_LE, APEX_COND_GT, APEX_COND_GE } ApexCondOp;
+
+typedef struct {
+    uint64_t breakMap[BITMAP_WORDS(CODE_MEMORY_SIZE)];
+    uint64_t watchPages[BITMAP_WORDS(DEBUG_WATCH_BITS)];
+    unsigned int watchAddr[DEBUG_MAX_WATCHES];
+    int watchCount;
+    int commitChecks;           // breakpoints or a condition are set, checked at every retire
+    long long untilRetired;     // 0 = off
+    int condReg;                // -1 = off
+    ApexCondOp condOp;
+    int condValue;
+
+    // Why and where the last run stopped
+    ApexStopReason stop;
+    int stopPc;
+    unsigned int stopAddr;
+    int stopOld, stopNew;
+} ApexDebug;
+
+// Machine configuration. Set with cpu_config_set("key=value") and applied
+// with cpu_configure() after cpu_init(). Fields that affect results are
+// also listed in apex_results_key().
+typedef struct {
+    int maxCycles;          // force-stop the run after this many cycles
+    int icacheSize;         // bytes, 0 = ideal fetch (every access hits)
+    int icacheAssoc;
+    int icacheLineSize;     // bytes
+    int icacheMissLatency;  // cycles
+    int itlbEntries;        // 0 = no ITLB
+    int itlbMissLatency;    // cycles
+    int pageSize;           // bytes, ITLB page size
+    int dmemSize;           // words of physical data memory
+    int dtlbEntries;        // 0 = untimed translation
+    int ptwLatency;         // cycles per page-table level on a DTLB miss
+    int memLimit;           // words, 0 = full 32-bit word address space
+    int memFaultTrap;       // halt on a memory fault instead of continuing
+    int ffEngine;           // fast-forward: 1 = translated blocks, 0 = switch interpreter
+    int bisEntries;         // rename checkpoints (branches in flight) in checkpoint mode
+    int robWalk;            // recover from mispredicts by walking the ROB instead of checkpoints
+    int robWalkWidth;       // ROB entries undone per cycle during a walk
+    int redirectPenalty;    // cycles before fetch restarts after a mispredict
+    int earlyResolve;       // resolve conditional branches as soon as their flags are ready
+    int valuePred;          // load/MUL value prediction: 0 off, 1 last value, 2 stride
+    int vpEntries;          // value predictor table size, a power of two
+    int vpThreshold;        // confidence needed before a value is predicted
+    int fusion;             // fuse CMP/CML/ADDL/SUBL with a following conditional branch at decode
+    int lsdSize;            // loop buffer capacity in ops, 0 = no loop stream detector
+    int idleSkip;           // jump the clock over cycles in which the machine is provably waiting
+    int specialize;         // run a cycle kernel compiled for this configuration when one exists
+    int prfReadPorts;       // PRF reads per cycle at issue, 0 = unlimited
+    int prfWritePorts;      // PRF result writes per cycle, 0 = unlimited
+    int bypass;             // BYPASS_NONE, BYPASS_CLUSTER or BYPASS_FULL
+    int wakeupDelay;        // cycles from a result broadcast to the earliest issue of a dependent
+    int storeBuffer;        // post-commit store buffer entries, 0 = stores write memory before retiring
+    int clockMhz;           // for power and EDP
+    int energy[ACC_COUNT];  // femtojoules per access
+} ApexConfig;
+
+typedef struct {
+    long long icacheAccesses;
+    long long icacheMisses;
+    long long itlbAccesses;
+    long long itlbMisses;
+    long long fetchStallCycles;
+    long long dtlbAccesses;
+    long long dtlbMisses;
+    long long pageWalks;
+    long long pageWalkCycles;
+    long long pagesAllocated;
+    long long memFaults;
+    long long ffInstructions;
+    long long ffBlocksTranslated;
+    long long recoveries;
+    long long recoveryCycles;       // modeled cycles rename was blocked by recovery
+    long long recoveryWalkEntries;
+    long long recoveryHostNs;
+    long long squashedInstructions;
+    long long wastedCycles;
+    long long redirectStallCycles;
+    long long earlyResolves;        // conditional branches resolved off the integer FU
+    long long vpEligible;           // committed loads and MULs with a destination
+    long long vpPredicted;          // ... of which were value-predicted at dispatch
+    long long vpCorrect;
+    long long vpFlushes;            // wrong predictions, each squashing younger work
+    long long fusedPairs;           // committed macro-ops, each retiring two instructions
+    long long robOccupancy;         // summed per cycle
+    long long rsOccupancy;
+    long long lsqOccupancy;
+    long long branches;             // committed control transfers
+    long long branchMispredicts;
+    long long fetchedOps;           // instructions fetched through F1
+    long long lsdOps;               // ... and streamed from the loop buffer instead
+    long long lsdCaptures;
+    long long prfReads;             // operands read from the PRF at issue rather than bypassed
+    long long readPortStalls;       // issue slots lost to a read-port conflict
+    long long writePortStalls;      // cycles issue was held for PRF write ports
+    long long deferredWrites;       // results that waited a cycle for a write port
+    long long sbStores;             // stores retired into the store buffer
+    long long sbCombined;           // ... of which merged into a line already buffered
+    long long sbDrains;             // lines written to memory
+    long long sbForwards;           // loads served from the store buffer
+    long long sbFullCycles;         // cycles a ready store could not retire, buffer full
+    long long accesses[ACC_COUNT];
+} ApexStats;
+
+typedef struct {
+    double accessNj[ACC_COUNT];
+    double dynamicNj;
+    double seconds;             // modeled run time at clock_mhz
+    double averageMw;
+    double edp;                 // energy-delay product, J*s
+} ApexEnergy;
+
+typedef struct ApexCpu {
     int pc;
     int clock;
     int simulationHalted;
@@ -139,16 +468,22 @@ typedef struct {
 
     // *** NEW FLAG ***
     int predictor_enabled;
+
+    ApexConfig config;
+    ApexStats stats;
     
     int arf[ARCH_REG_FILE_SIZE];
     int rat[ARCH_REG_FILE_SIZE];
     int ratCc;
     
-    PhysicalRegister prf[PHYS_REG_FILE_SIZE];
-    PhysicalRegister cprf[CC_REG_FILE_SIZE];
+    // Register files as struct-of-arrays; a set bit in a free list is a free register
+    int prfValue[PHYS_REG_FILE_SIZE];
+    int cprfValue[CC_REG_FILE_SIZE];
+    RegBitmap prfValid;
+    RegBitmap cprfValid;
     
-    IntQueue freeListPrf;
-    IntQueue freeListCprf;
+    RegBitmap freeListPrf;
+    RegBitmap freeListCprf;
     
     RobEntry rob[ROB_SIZE];
     int robHead, robTail, robCount;
@@ -161,6 +496,17 @@ typedef struct {
     
     BisEntry bis[BIS_SIZE];
     int bisHead, bisTail, bisCount;
+    int bisLimit;
+    int renameResumeCycle;          // rename blocked until this cycle by a ROB walk
+    int redirectReadyCycle;         // fetch blocked until this cycle after a mispredict
+    BranchStats branchStats[CODE_MEMORY_SIZE];
+    PcProfile pcProfile[CODE_MEMORY_SIZE];
+    int codeSourceLine[CODE_MEMORY_SIZE];   // 1-based .asm line of each instruction
+    ProfileFrame profFrames[PROFILE_MAX_FRAMES];
+    int profFrameCount;
+    int profFrame;                  // current call path, follows committed calls and returns
+    
+    ValuePredEntry valuePred[VP_MAX_ENTRIES];
     
     BtbEntry btb[8];
     CtpEntry ctp[4];
@@ -175,23 +521,111 @@ typedef struct {
     Instruction *mulPipeline[3];
     Instruction *mauPipeline[2];
     
-    int dataMemory[DATA_MEMORY_SIZE];
+    int* pageTable[PT_ENTRIES];     // root level; leaves hold frame+1, 0 = unmapped
+    int** frames;                   // physical frames, allocated on first touch
+    int frameCount;
+    int framesUsed;
+    TlbEntry dtlb[TLB_MAX_ENTRIES];
+    int mauWalkCycles;
+    StoreBufferEntry storeBuffer[STORE_BUFFER_MAX];
+    int sbHead, sbCount;
+    int sbDrainCycles;              // until the draining line is written, DTLB walk included
     Instruction codeMemory[CODE_MEMORY_SIZE];
+    int codeVersion;                // bumped whenever codeMemory is rewritten
     
-    ForwardingData forwardingBuffer[16];
+    // Functional fast-forward state: ARF plus a zero slot and a write sink
+    int ffRegs[ARCH_REG_FILE_SIZE + 2];
+    int ffFlags;
+    int ffNextPc;
+    int ffStop;
+    long long ffBudget;             // instructions left to run
+    struct TransBlock** ffLink;     // block exit waiting for its successor
+    FfPageSlot ffReadPages[FF_PAGE_SLOTS];     // unmapped pages read as a shared zero page
+    FfPageSlot ffWritePages[FF_PAGE_SLOTS];
+    struct TransBlock* blockCache[CODE_MEMORY_SIZE];
+    int blockCacheVersion;
+    
+    ForwardingData forwardingBuffer[32];    // room for results held back by PRF write ports
     int forwardingCount;
     
+    CacheLine icache[ICACHE_MAX_LINES];
+    int icacheSets;
+    TlbEntry itlb[TLB_MAX_ENTRIES];
+    int fetchMissPc;
+    int fetchReadyCycle;
+    
+    LoopBuffer lsd;
+    Instruction* instrPool[INSTR_POOL_SIZE];
+    int instrPoolCount;
+    
+    void (*cycleKernel[2])(struct ApexCpu* cpu);    // per predictor_enabled, chosen from the config
+
     int fetchStalled;
     int globalDispatchCounter;
     int wasFlushed;
     int wasStalled;
+    
+    ApexLogFn logFn;
+    void* logUser;
+    int logLevel;
+    ApexHook hooks[APEX_HOOK_COUNT];
+    ApexDebug* debug;               // NULL = no debugger attached
+    ApexSampleFn sampleFn;          // called every sampleInterval cycles
+    void* sampleUser;
+    int sampleInterval;
+    int nextSample;
 } ApexCpu;
 
 void cpu_init(ApexCpu* cpu);
-void cpu_load_program(ApexCpu* cpu, const char* filename);
+int cpu_load_program(ApexCpu* cpu, const char* filename);
 void cpu_simulate_cycle(ApexCpu* cpu);
 void cpu_display(ApexCpu* cpu);
 void cpu_display_all_stages(ApexCpu* cpu);
 void cpu_set_memory(ApexCpu* cpu, int address, int value);
+void cpu_release(ApexCpu* cpu);
+int cpu_load_memory_image(ApexCpu* cpu, const char* path, unsigned int base);
+int cpu_load_memory_text(ApexCpu* cpu, const char* path, unsigned int base);
+
+void cpu_config_defaults(ApexConfig* cfg);
+int cpu_config_set(ApexConfig* cfg, const char* option);
+int cpu_configure(ApexCpu* cpu, const ApexConfig* cfg);
+void cpu_display_stats(ApexCpu* cpu);
+long long cpu_fast_forward(ApexCpu* cpu, long long count);
+
+// Embedding API. Each ApexCpu is self-contained, so any number of
+// instances may run in one process (one thread per instance). libapex
+// exports only cpu_* for the core and apex_<module>_* for the modules
+// built on it (apex_debug_*, apex_session_*, apex_batch_*, ...).
+ApexCpu* cpu_create(const ApexConfig* cfg);
+void cpu_destroy(ApexCpu* cpu);
+ApexCpu* cpu_clone(const ApexCpu* cpu);
+int cpu_load_program_text(ApexCpu* cpu, const char* text, size_t length);
+int cpu_load_memory_words(ApexCpu* cpu, unsigned int base, const int* words, int count);
+long long cpu_step(ApexCpu* cpu, long long cycles);
+long long cpu_run_until(ApexCpu* cpu, ApexPredicate done, void* user, long long maxCycles);
+void cpu_set_logger(ApexCpu* cpu, ApexLogFn fn, void* user, int level);
+void cpu_log(ApexCpu* cpu, int level, const char* fmt, ...);
+void cpu_set_hook(ApexCpu* cpu, ApexHookEvent event, ApexHookFn fn, void* user);
+void cpu_set_sampler(ApexCpu* cpu, int interval, ApexSampleFn fn, void* user);
+const ApexStats* cpu_stats(const ApexCpu* cpu);
+void cpu_energy(const ApexCpu* cpu, ApexEnergy* out);
+int cpu_profile_listing(ApexCpu* cpu, const char* sourcePath, FILE* out);
+int cpu_profile_folded(ApexCpu* cpu, FILE* out);
+int cpu_cycles(const ApexCpu* cpu);
+int cpu_retired(const ApexCpu* cpu);
+int cpu_halted(const ApexCpu* cpu);
+int cpu_read_reg(const ApexCpu* cpu, int reg);
+int cpu_read_memory(ApexCpu* cpu, unsigned int addr, int* value);
+
+// Debugger. The ApexDebug is owned by the caller and may be shared by
+// several CPUs (a clone keeps its original's). cpu_step() and
+// cpu_run_until() clear the last stop and return early on a new one.
+void cpu_set_debugger(ApexCpu* cpu, ApexDebug* debug);
+int cpu_stopped(const ApexCpu* cpu);
+void apex_debug_init(ApexDebug* d);
+int apex_debug_set_break(ApexDebug* d, int pc, int on);
+int apex_debug_set_watch(ApexDebug* d, unsigned int addr, int on);
+void apex_debug_set_until(ApexDebug* d, long long retired, int reg, ApexCondOp op, int value);
+int apex_debug_cond_holds(const ApexDebug* d, int value);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+ * apex_metrics.c
+ *
+ * Shared-memory metrics ring: one publisher, any number of viewers.
+ */
+
+#include "apex_metrics.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// --------------------------------------------------------------------
+// PUBLISHER
+// --------------------------------------------------------------------
+int apex_metrics_open(ApexMetrics* m, const char* name, const char* program, int interval) {
+    memset(m, 0, sizeof(ApexMetrics));
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if(fd < 0) return FALSE;
+    int ok = ftruncate(fd, sizeof(MetricsRing)) == 0;
+    void* map = ok ? mmap(NULL, sizeof(MetricsRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) {
+        shm_unlink(name);
+        return FALSE;
+    }
+    m->ring = (MetricsRing*)map;
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    MetricsRing* r = m->ring;
+    r->version = METRICS_VERSION;
+    r->slots = METRICS_SLOTS;
+    r->recordSize = sizeof(MetricsRecord);
+    r->pid = (int32_t)getpid();
+    r->interval = interval;
+    snprintf(r->program, sizeof(r->program), "%s", program);
+    // Viewers check the magic first, so it goes in once the header is complete
+    __atomic_store_n(&r->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+// Never blocks: the oldest slot is overwritten whether or not it was read
+void apex_metrics_publish(ApexMetrics* m, const ApexCpu* cpu) {
+    if(!m->ring) return;
+    MetricsRing* ring = m->ring;
+    uint64_t n = ring->published;
+    MetricsRecord* r = &ring->records[n % METRICS_SLOTS];
+    __atomic_store_n(&r->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const ApexStats* st = &cpu->stats;
+    r->hostNs = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    r->cycle = cpu->clock;
+    r->retired = cpu->instructionsRetired;
+    r->robOccupancy = st->robOccupancy;
+    r->rsOccupancy = st->rsOccupancy;
+    r->lsqOccupancy = st->lsqOccupancy;
+    r->branches = st->branches;
+    r->branchMispredicts = st->branchMispredicts;
+    r->icacheAccesses = st->icacheAccesses;
+    r->icacheMisses = st->icacheMisses;
+    r->itlbAccesses = st->itlbAccesses;
+    r->itlbMisses = st->itlbMisses;
+    r->dtlbAccesses = st->dtlbAccesses;
+    r->dtlbMisses = st->dtlbMisses;
+    r->robCount = cpu->robCount;
+    r->lsqCount = cpu->lsqCount;
+    r->halted = cpu->simulationHalted;
+
+    __atomic_store_n(&r->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->published, n + 1, __ATOMIC_RELEASE);
+}
+
+void apex_metrics_sample(ApexCpu* cpu, void* user) {
+    apex_metrics_publish((ApexMetrics*)user, cpu);
+}
+
+// Viewers already attached keep their mapping and can still read the
+// final records
+void apex_metrics_close(ApexMetrics* m) {
+    if(!m->ring) return;
+    munmap(m->ring, sizeof(MetricsRing));
+    shm_unlink(m->name);
+    m->ring = NULL;
+}
+
+// --------------------------------------------------------------------
+// VIEWER
+// --------------------------------------------------------------------
+const MetricsRing* apex_metrics_attach(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+    struct stat st;
+    int ok = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(MetricsRing);
+    void* map = ok ? mmap(NULL, sizeof(MetricsRing), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) return NULL;
+    const MetricsRing* ring = (const MetricsRing*)map;
+    if(__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || ring->version != METRICS_VERSION ||
+       ring->recordSize != sizeof(MetricsRecord) || ring->slots != METRICS_SLOTS) {
+        munmap(map, sizeof(MetricsRing));
+        return NULL;
+    }
+    return ring;
+}
+
+void apex_metrics_detach(const MetricsRing* ring) {
+    if(ring) munmap((void*)ring, sizeof(MetricsRing));
+}
+
+// Copies record index. Returns FALSE when it is not published yet or has
+// been (or is being) overwritten by a newer one.
+int apex_metrics_read(const MetricsRing* ring, uint64_t index, MetricsRecord* out) {
+    const MetricsRecord* r = &ring->records[index % METRICS_SLOTS];
+    uint64_t want = 2 * index + 2;
+    if(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != want) return FALSE;
+    memcpy(out, r, sizeof(MetricsRecord));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == want;
+}
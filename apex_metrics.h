@@ -0,0 +1,70 @@
+#ifndef APEX_METRICS_H
+#define APEX_METRICS_H
+
+#include "apex_cpu.h"
+
+// Live metrics for long runs. A publisher copies the CPU's cumulative
+// counters into a ring of records in POSIX shared memory every interval
+// cycles; viewers (apex_top) map the ring read-only and diff consecutive
+// records. The ring has one producer and never waits for consumers: each
+// slot carries a sequence number, odd while it is being written, and a
+// reader that sees it change retries or skips the record.
+
+#define METRICS_MAGIC 0x41504d52u     // "APMR"
+#define METRICS_VERSION 1
+#define METRICS_SLOTS 256
+#define METRICS_INTERVAL 100000       // cycles between records
+
+typedef struct {
+    uint64_t seq;               // 2 * index + 2 once record index is complete
+    int64_t hostNs;             // CLOCK_MONOTONIC when published
+    int64_t cycle;
+    int64_t retired;
+    int64_t robOccupancy;       // summed per cycle, as in ApexStats
+    int64_t rsOccupancy;
+    int64_t lsqOccupancy;
+    int64_t branches;
+    int64_t branchMispredicts;
+    int64_t icacheAccesses;
+    int64_t icacheMisses;
+    int64_t itlbAccesses;
+    int64_t itlbMisses;
+    int64_t dtlbAccesses;
+    int64_t dtlbMisses;
+    int32_t robCount;           // occupancy at the moment of publishing
+    int32_t lsqCount;
+    int32_t halted;
+    int32_t pad;
+} MetricsRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t recordSize;
+    int32_t pid;
+    int32_t interval;
+    char program[64];
+    uint64_t published;         // records written so far
+    MetricsRecord records[METRICS_SLOTS];
+} MetricsRing;
+
+typedef struct {
+    MetricsRing* ring;
+    char name[64];
+} ApexMetrics;
+
+// Publisher. name is a shared memory object name such as "/apex". Attach
+// apex_metrics_sample as the CPU's sampler with the same interval;
+// apex_metrics_publish() can also be called directly, e.g. when the run ends.
+int apex_metrics_open(ApexMetrics* m, const char* name, const char* program, int interval);
+void apex_metrics_publish(ApexMetrics* m, const ApexCpu* cpu);
+void apex_metrics_sample(ApexCpu* cpu, void* user);
+void apex_metrics_close(ApexMetrics* m);
+
+// Viewer
+const MetricsRing* apex_metrics_attach(const char* name);
+void apex_metrics_detach(const MetricsRing* ring);
+int apex_metrics_read(const MetricsRing* ring, uint64_t index, MetricsRecord* out);
+
+#endif
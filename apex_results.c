@@ -0,0 +1,213 @@
+/*
+ * apex_results.c
+ *
+ * Content-addressed cache of finished runs, one file per key:
+ *
+ *   ResultHeader, ApexStats, then per mapped data page its VPN and words
+ */
+
+#include "apex_results.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define RESULTS_MAGIC 0x41505253u    // "APRS"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t modelVersion;
+    uint32_t statsSize;
+    uint32_t pageCount;
+    ResultKey key;
+    double hostSeconds;
+    int32_t clock;
+    int32_t retired;
+    int32_t pc;
+    int32_t pad;
+    int32_t arf[ARCH_REG_FILE_SIZE];
+} ResultHeader;
+
+int apex_results_open(ResultCache* c, const char* dir) {
+    memset(c, 0, sizeof(ResultCache));
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST) return FALSE;
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+    return TRUE;
+}
+
+// --------------------------------------------------------------------
+// KEY
+// --------------------------------------------------------------------
+// Two independent 64-bit hashes over the same words: FNV-1a and a
+// multiply-xorshift mix
+static void key_add(ResultKey* k, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    for(size_t i=0; i<bytes; i++) {
+        k->lo = (k->lo ^ p[i]) * 0x100000001b3ULL;
+        k->hi = (k->hi ^ p[i]) * 0x9e3779b97f4a7c15ULL;
+        k->hi ^= k->hi >> 29;
+    }
+}
+
+static void key_add_int(ResultKey* k, int value) {
+    key_add(k, &value, sizeof(value));
+}
+
+// The loaded program: code memory and the initial data memory image
+static void key_add_program(ResultKey* k, ApexCpu* cpu) {
+    for(int i=0; i<CODE_MEMORY_SIZE; i++) {
+        const Instruction* op = &cpu->codeMemory[i];
+        int fields[5] = {op->opcode, op->rd, op->rs1, op->rs2, op->imm};
+        key_add(k, fields, sizeof(fields));
+    }
+    for(int i=0; i<PT_ENTRIES; i++) {
+        if(!cpu->pageTable[i]) continue;
+        for(int j=0; j<PT_ENTRIES; j++) {
+            int pte = cpu->pageTable[i][j];
+            if(!pte) continue;
+            key_add_int(k, (i << PT_LEVEL_BITS) | j);
+            key_add(k, cpu->frames[pte - 1], PAGE_WORDS * sizeof(int));
+        }
+    }
+}
+
+// Computed on a loaded CPU before it runs. Only the options that can
+// change the stored results are hashed, field by field, so runs differing
+// in the others share an entry: idle skipping, kernel specialization and
+// the fast-forward engine give identical results, and energy and power are
+// recomputed from the stored access counts on every hit. A new ApexConfig
+// field that affects timing or results must be added here.
+ResultKey apex_results_key(ApexCpu* cpu) {
+    ResultKey k = {0xcbf29ce484222325ULL, 0x6a09e667f3bcc908ULL};
+    const ApexConfig* c = &cpu->config;
+    key_add_int(&k, APEX_MODEL_VERSION);
+    key_add_int(&k, (int)sizeof(ApexStats));
+    key_add_int(&k, c->maxCycles);
+    key_add_int(&k, c->icacheSize);
+    key_add_int(&k, c->icacheAssoc);
+    key_add_int(&k, c->icacheLineSize);
+    key_add_int(&k, c->icacheMissLatency);
+    key_add_int(&k, c->itlbEntries);
+    key_add_int(&k, c->itlbMissLatency);
+    key_add_int(&k, c->pageSize);
+    key_add_int(&k, c->dmemSize);
+    key_add_int(&k, c->dtlbEntries);
+    key_add_int(&k, c->ptwLatency);
+    key_add_int(&k, c->memLimit);
+    key_add_int(&k, c->memFaultTrap);
+    key_add_int(&k, c->bisEntries);
+    key_add_int(&k, c->robWalk);
+    key_add_int(&k, c->robWalkWidth);
+    key_add_int(&k, c->redirectPenalty);
+    key_add_int(&k, c->earlyResolve);
+    key_add_int(&k, c->valuePred);
+    key_add_int(&k, c->vpEntries);
+    key_add_int(&k, c->vpThreshold);
+    key_add_int(&k, c->fusion);
+    key_add_int(&k, c->lsdSize);
+    key_add_int(&k, c->prfReadPorts);
+    key_add_int(&k, c->prfWritePorts);
+    key_add_int(&k, c->bypass);
+    key_add_int(&k, c->wakeupDelay);
+    key_add_int(&k, c->storeBuffer);
+    key_add_int(&k, cpu->predictor_enabled != 0);
+    key_add_int(&k, cpu->pc);
+    key_add_program(&k, cpu);
+    return k;
+}
+
+// Identifies the program alone, independent of configuration and model
+// version; computed on a freshly loaded CPU
+ResultKey apex_results_program_key(ApexCpu* cpu) {
+    ResultKey k = {0xcbf29ce484222325ULL, 0x6a09e667f3bcc908ULL};
+    key_add_program(&k, cpu);
+    return k;
+}
+
+static void entry_path(const ResultCache* c, ResultKey key, char* path, size_t size) {
+    snprintf(path, size, "%s/%016llx%016llx.res", c->dir, (unsigned long long)key.hi, (unsigned long long)key.lo);
+}
+
+// --------------------------------------------------------------------
+// ENTRIES
+// --------------------------------------------------------------------
+// On a hit, cpu (loaded, not yet run) is put into the stored end state
+// and halted. A missing, stale or damaged entry is a miss.
+int apex_results_lookup(ResultCache* c, ResultKey key, ApexCpu* cpu) {
+    char path[320];
+    entry_path(c, key, path, sizeof(path));
+    c->lookups++;
+    FILE* f = fopen(path, "rb");
+    if(!f) return FALSE;
+    ResultHeader h;
+    ApexStats stats;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == RESULTS_MAGIC && h.modelVersion == APEX_MODEL_VERSION &&
+             h.statsSize == sizeof(ApexStats) && h.key.lo == key.lo && h.key.hi == key.hi &&
+             fread(&stats, sizeof(stats), 1, f) == 1;
+    // Read every page before touching the CPU, so a short file changes nothing
+    size_t pageBytes = sizeof(uint32_t) + PAGE_WORDS * sizeof(int);
+    unsigned char* pages = ok ? (unsigned char*)malloc(h.pageCount ? h.pageCount * pageBytes : 1) : NULL;
+    ok = pages && fread(pages, pageBytes, h.pageCount, f) == h.pageCount;
+    fclose(f);
+    if(!ok) {
+        free(pages);
+        return FALSE;
+    }
+    for(uint32_t p=0; p<h.pageCount; p++) {
+        uint32_t vpn;
+        memcpy(&vpn, pages + p * pageBytes, sizeof(vpn));
+        cpu_load_memory_words(cpu, vpn << PAGE_SHIFT, (const int*)(pages + p * pageBytes + sizeof(vpn)), PAGE_WORDS);
+    }
+    free(pages);
+    cpu->clock = h.clock;
+    cpu->instructionsRetired = h.retired;
+    cpu->pc = h.pc;
+    memcpy(cpu->arf, h.arf, sizeof(cpu->arf));
+    cpu->stats = stats;
+    cpu->simulationHalted = TRUE;
+    c->hits++;
+    c->savedSeconds += h.hostSeconds;
+    return TRUE;
+}
+
+// Stores a halted run under the key taken before it ran. Written to a
+// temporary file and renamed, so concurrent sweeps never read half an entry.
+int apex_results_store(ResultCache* c, ResultKey key, ApexCpu* cpu, double hostSeconds) {
+    if(!cpu->simulationHalted) return FALSE;
+    char path[320], tmp[340];
+    entry_path(c, key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE* f = fopen(tmp, "wb");
+    if(!f) return FALSE;
+
+    ResultHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = RESULTS_MAGIC;
+    h.modelVersion = APEX_MODEL_VERSION;
+    h.statsSize = sizeof(ApexStats);
+    h.key = key;
+    h.hostSeconds = hostSeconds;
+    h.clock = cpu->clock;
+    h.retired = cpu->instructionsRetired;
+    h.pc = cpu->pc;
+    memcpy(h.arf, cpu->arf, sizeof(h.arf));
+    for(int i=0; i<PT_ENTRIES; i++) {
+        if(!cpu->pageTable[i]) continue;
+        for(int j=0; j<PT_ENTRIES; j++) h.pageCount += (cpu->pageTable[i][j] != 0);
+    }
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&cpu->stats, sizeof(ApexStats), 1, f) == 1;
+    for(int i=0; ok && i<PT_ENTRIES; i++) {
+        if(!cpu->pageTable[i]) continue;
+        for(int j=0; ok && j<PT_ENTRIES; j++) {
+            int pte = cpu->pageTable[i][j];
+            if(!pte) continue;
+            uint32_t vpn = ((uint32_t)i << PT_LEVEL_BITS) | j;
+            ok = fwrite(&vpn, sizeof(vpn), 1, f) == 1 && fwrite(cpu->frames[pte - 1], sizeof(int), PAGE_WORDS, f) == PAGE_WORDS;
+        }
+    }
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,32 @@
+#ifndef APEX_RESULTS_H
+#define APEX_RESULTS_H
+
+#include "apex_cpu.h"
+
+// On-disk cache of finished runs. The key is a 128-bit hash of everything
+// that determines a run's outcome: the model version, the decoded program,
+// the initial data memory, every option that affects results and the
+// predictor flag.
+// An entry holds the statistics and final architectural state (registers,
+// PC and data memory), so a hit puts a freshly loaded CPU straight into its
+// halted end state. Entries from another model version never match, and
+// are replaced as runs are stored again.
+
+typedef struct {
+    uint64_t lo, hi;
+} ResultKey;
+
+typedef struct {
+    char dir[256];
+    long long lookups;
+    long long hits;
+    double savedSeconds;        // host time the hits originally took to simulate
+} ResultCache;
+
+int apex_results_open(ResultCache* c, const char* dir);
+ResultKey apex_results_key(ApexCpu* cpu);
+ResultKey apex_results_program_key(ApexCpu* cpu);
+int apex_results_lookup(ResultCache* c, ResultKey key, ApexCpu* cpu);
+int apex_results_store(ResultCache* c, ResultKey key, ApexCpu* cpu, double hostSeconds);
+
+#endif
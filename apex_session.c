@@ -0,0 +1,423 @@
+/*
+ * apex_session.c
+ *
+ * Session recording, replay and seeking on top of the embedding API.
+ *
+ * Log format, one entry per line:
+ *
+ *   apex-session 2 <program hash>
+ *   args <predictor flag and key=value options>
+ *   <cycle> mem <addr> <value>
+ *   <cycle> words <addr> <count> <value> ...
+ *   <cycle> ff <instructions>
+ *   <cycle> init
+ *   <cycle> end
+ *
+ * The program hash covers the assembled code and initial data image
+ * (apex_results_program_key), so a log only replays against the program it
+ * was recorded with.
+ */
+
+#include "apex_session.h"
+
+void apex_session_init(ApexSession* s) {
+    memset(s, 0, sizeof(ApexSession));
+    s->snapshotInterval = SESSION_SNAPSHOT_INTERVAL;
+}
+
+// --------------------------------------------------------------------
+// LOG
+// --------------------------------------------------------------------
+static SessionEvent* session_append(ApexSession* s) {
+    if(s->eventCount == s->eventCap) {
+        int cap = s->eventCap ? s->eventCap * 2 : 64;
+        SessionEvent* grown = (SessionEvent*)realloc(s->events, cap * sizeof(SessionEvent));
+        if(!grown) return NULL;
+        s->events = grown;
+        s->eventCap = cap;
+    }
+    SessionEvent* ev = &s->events[s->eventCount++];
+    memset(ev, 0, sizeof(SessionEvent));
+    return ev;
+}
+
+static void session_write_event(FILE* f, const SessionEvent* ev) {
+    switch(ev->kind) {
+        case SESSION_MEM: fprintf(f, "%lld mem %u %d\n", ev->cycle, ev->addr, (int)ev->value); break;
+        case SESSION_WORDS:
+            fprintf(f, "%lld words %u %d", ev->cycle, ev->addr, ev->count);
+            for(int k=0; k<ev->count; k++) fprintf(f, " %d", ev->words[k]);
+            fputc('\n', f);
+            break;
+        case SESSION_FF: fprintf(f, "%lld ff %lld\n", ev->cycle, ev->value); break;
+        case SESSION_INIT: fprintf(f, "%lld init\n", ev->cycle); break;
+    }
+}
+
+static void session_write_header(ApexSession* s) {
+    fprintf(s->record, "apex-session 2 %016llx%016llx\nargs %s\n",
+            (unsigned long long)s->programKey.hi, (unsigned long long)s->programKey.lo, s->args);
+    for(int k=0; k<s->next; k++) session_write_event(s->record, &s->events[k]);
+    fflush(s->record);
+}
+
+// Parses one log line into ev. Returns FALSE on a malformed line.
+static int session_parse_event(char* line, SessionEvent* ev, int* isEnd) {
+    char* p = line;
+    char* end;
+    *isEnd = FALSE;
+    ev->cycle = strtoll(p, &end, 10);
+    if(end == p || ev->cycle < 0) return FALSE;
+    p = end;
+    while(*p == ' ') p++;
+    char* kind = p;
+    while(*p && *p != ' ' && *p != '\n') p++;
+    int kindLen = (int)(p - kind);
+    if(kindLen == 3 && !strncmp(kind, "end", 3)) {
+        *isEnd = TRUE;
+        return TRUE;
+    }
+    if(kindLen == 4 && !strncmp(kind, "init", 4)) {
+        ev->kind = SESSION_INIT;
+        return TRUE;
+    }
+    if(kindLen == 2 && !strncmp(kind, "ff", 2)) {
+        ev->kind = SESSION_FF;
+        ev->value = strtoll(p, &end, 10);
+        return end != p && ev->value >= 0;
+    }
+    if(kindLen == 3 && !strncmp(kind, "mem", 3)) {
+        ev->kind = SESSION_MEM;
+        ev->addr = (unsigned int)strtoul(p, &end, 10);
+        if(end == p) return FALSE;
+        p = end;
+        ev->value = strtol(p, &end, 10);
+        return end != p;
+    }
+    if(kindLen == 5 && !strncmp(kind, "words", 5)) {
+        ev->kind = SESSION_WORDS;
+        ev->addr = (unsigned int)strtoul(p, &end, 10);
+        if(end == p) return FALSE;
+        p = end;
+        ev->count = (int)strtol(p, &end, 10);
+        if(end == p || ev->count < 0) return FALSE;
+        p = end;
+        ev->words = (int*)malloc((ev->count ? ev->count : 1) * sizeof(int));
+        if(!ev->words) return FALSE;
+        for(int k=0; k<ev->count; k++) {
+            ev->words[k] = (int)strtol(p, &end, 10);
+            if(end == p) return FALSE;
+            p = end;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+int apex_session_load(ApexSession* s, const char* path) {
+    s->badLine = 0;
+    FILE* f = fopen(path, "r");
+    if(!f) return FALSE;
+    char* line = NULL;
+    size_t cap = 0;
+    int lineNo = 0, ok = TRUE, ended = FALSE;
+    while(ok && getline(&line, &cap, f) > 0) {
+        lineNo++;
+        if(lineNo == 1) {
+            unsigned long long hi, lo;
+            ok = sscanf(line, "apex-session 2 %16llx%16llx", &hi, &lo) == 2;
+            s->programKey.hi = hi;
+            s->programKey.lo = lo;
+            s->programKnown = ok;
+            continue;
+        }
+        if(lineNo == 2) {
+            ok = !strncmp(line, "args", 4);
+            if(ok) {
+                snprintf(s->args, sizeof(s->args), "%s", line + 4 + (line[4] == ' '));
+                s->args[strcspn(s->args, "\n")] = 0;
+            }
+            continue;
+        }
+        if(ended) continue;
+        SessionEvent* ev = session_append(s);
+        int isEnd;
+        ok = ev && session_parse_event(line, ev, &isEnd);
+        if(ok && s->eventCount > 1 && ev->cycle < s->events[s->eventCount - 2].cycle) ok = FALSE;
+        if(ok && ev->cycle > s->endCycle) s->endCycle = ev->cycle;
+        if(ev && (!ok || isEnd)) {
+            free(ev->words);
+            s->eventCount--;
+        }
+        ended = ok && isEnd;
+    }
+    free(line);
+    fclose(f);
+    if(!ok || lineNo < 2) {
+        s->badLine = lineNo > 0 ? lineNo : 1;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Drops log entries from next on, along with snapshots taken after them:
+// a new input at this point replaces the recorded future.
+static void session_truncate(ApexSession* s) {
+    for(int k=s->next; k<s->eventCount; k++) free(s->events[k].words);
+    s->eventCount = s->next;
+    s->endCycle = s->cycle;
+    int kept = 0;
+    for(int k=0; k<s->snapshotCount; k++) {
+        SessionSnapshot* snap = &s->snapshots[k];
+        if(snap->cycle > s->cycle || snap->event > s->next) cpu_destroy(snap->cpu);
+        else s->snapshots[kept++] = *snap;
+    }
+    s->snapshotCount = kept;
+    if(s->record) {
+        s->record = freopen(s->recordPath, "w", s->record);
+        if(s->record) session_write_header(s);
+    }
+}
+
+// --------------------------------------------------------------------
+// SNAPSHOTS
+// --------------------------------------------------------------------
+// Taken just before a cycle is simulated, so a snapshot includes every
+// input logged at its cycle. When the table fills, every other snapshot is
+// dropped and the interval doubles.
+static void session_snapshot(ApexSession* s) {
+    if(s->cycle % s->snapshotInterval != 0) return;
+    int pos = 0;
+    while(pos < s->snapshotCount && s->snapshots[pos].cycle < s->cycle) pos++;
+    if(pos < s->snapshotCount && s->snapshots[pos].cycle == s->cycle) return;
+    if(s->snapshotCount == SESSION_MAX_SNAPSHOTS) {
+        int kept = 0;
+        for(int k=0; k<s->snapshotCount; k++) {
+            if(k % 2 == 0) s->snapshots[kept++] = s->snapshots[k];
+            else cpu_destroy(s->snapshots[k].cpu);
+        }
+        s->snapshotCount = kept;
+        s->snapshotInterval *= 2;
+        session_snapshot(s);
+        return;
+    }
+    ApexCpu* copy = cpu_clone(s->cpu);
+    if(!copy) return;
+    memmove(&s->snapshots[pos + 1], &s->snapshots[pos], (s->snapshotCount - pos) * sizeof(SessionSnapshot));
+    s->snapshots[pos].cycle = s->cycle;
+    s->snapshots[pos].event = s->next;
+    s->snapshots[pos].cpu = copy;
+    s->snapshotCount++;
+}
+
+// --------------------------------------------------------------------
+// INPUTS
+// --------------------------------------------------------------------
+static void session_attach(ApexSession* s) {
+    cpu_set_debugger(s->cpu, s->debug);
+    cpu_set_sampler(s->cpu, s->sampleInterval, s->sampleFn, s->sampleUser);
+}
+
+// A session is bound to the program it started with; the file is read
+// again on every reset, so it is checked each time it is loaded
+static int session_same_program(ApexSession* s, ApexCpu* cpu) {
+    ResultKey key = apex_results_program_key(cpu);
+    if(key.hi == s->programKey.hi && key.lo == s->programKey.lo) return TRUE;
+    cpu_log(cpu, APEX_LOG_ERROR, "Error: %s does not match the session's program\n", s->program);
+    return FALSE;
+}
+
+// Returns the fast-forward result for SESSION_FF, 0 otherwise
+static long long session_apply(ApexSession* s, const SessionEvent* ev) {
+    ApexCpu* cpu = s->cpu;
+    switch(ev->kind) {
+        case SESSION_MEM: cpu_set_memory(cpu, (int)ev->addr, (int)ev->value); break;
+        case SESSION_WORDS: cpu_load_memory_words(cpu, ev->addr, ev->words, ev->count); break;
+        case SESSION_FF: return cpu_fast_forward(cpu, ev->value);
+        case SESSION_INIT:
+            cpu_release(cpu);
+            cpu_init(cpu);
+            cpu_configure(cpu, &s->config);
+            cpu_load_program(cpu, s->program);
+            cpu->predictor_enabled = s->predictor;
+            session_attach(s);
+            if(!session_same_program(s, cpu)) cpu->simulationHalted = TRUE;
+            break;
+    }
+    return 0;
+}
+
+static void session_apply_due(ApexSession* s) {
+    while(s->next < s->eventCount && s->events[s->next].cycle <= s->cycle) {
+        session_apply(s, &s->events[s->next++]);
+    }
+}
+
+// Logs a new input at the current cycle and applies it. words, if any,
+// become owned by the log.
+static long long session_input(ApexSession* s, SessionEventKind kind, unsigned int addr, long long value, int count, int* words) {
+    if(s->next < s->eventCount || s->cycle < s->endCycle) session_truncate(s);
+    SessionEvent* ev = session_append(s);
+    if(!ev) {
+        free(words);
+        return 0;
+    }
+    ev->cycle = s->cycle;
+    ev->kind = kind;
+    ev->addr = addr;
+    ev->value = value;
+    ev->count = count;
+    ev->words = words;
+    if(s->record) {
+        session_write_event(s->record, ev);
+        fflush(s->record);
+    }
+    // Inputs whose effect was already applied (memory loads) are only logged
+    long long result = (kind != SESSION_WORDS) ? session_apply(s, ev) : 0;
+    s->next++;
+    return result;
+}
+
+void apex_session_reset(ApexSession* s) {
+    session_input(s, SESSION_INIT, 0, 0, 0, NULL);
+}
+
+void apex_session_set_memory(ApexSession* s, int address, int value) {
+    session_input(s, SESSION_MEM, (unsigned int)address, value, 0, NULL);
+}
+
+// "*.bin" files are raw word images, anything else is decimal text. The
+// words are logged rather than the file name, so replay does not depend
+// on the file still existing unchanged.
+int apex_session_load_memory(ApexSession* s, const char* path) {
+    size_t len = strlen(path);
+    int loaded = (len > 4 && !strcmp(path + len - 4, ".bin"))
+        ? cpu_load_memory_image(s->cpu, path, 0)
+        : cpu_load_memory_text(s->cpu, path, 0);
+    if(loaded <= 0) return loaded;
+    int* words = (int*)malloc(loaded * sizeof(int));
+    if(!words) return loaded;
+    for(int k=0; k<loaded; k++) cpu_read_memory(s->cpu, (unsigned int)k, &words[k]);
+    session_input(s, SESSION_WORDS, 0, 0, loaded, words);
+    return loaded;
+}
+
+long long apex_session_fast_forward(ApexSession* s, long long count) {
+    return session_input(s, SESSION_FF, 0, count, 0, NULL);
+}
+
+// --------------------------------------------------------------------
+// RUNNING
+// --------------------------------------------------------------------
+int apex_session_start(ApexSession* s, const char* program, const ApexConfig* cfg, int predictor) {
+    s->program = program;
+    s->config = *cfg;
+    s->predictor = predictor;
+    s->cpu = cpu_create(cfg);
+    if(!s->cpu) return FALSE;
+    if(cpu_load_program(s->cpu, program) < 0) return FALSE;
+    s->cpu->predictor_enabled = predictor;
+    session_attach(s);
+    // A loaded log names its program; a new session takes this one
+    if(s->programKnown) return session_same_program(s, s->cpu);
+    s->programKey = apex_results_program_key(s->cpu);
+    s->programKnown = TRUE;
+    return TRUE;
+}
+
+void apex_session_set_debugger(ApexSession* s, ApexDebug* debug) {
+    s->debug = debug;
+    if(s->cpu) session_attach(s);
+}
+
+void apex_session_set_sampler(ApexSession* s, int interval, ApexSampleFn fn, void* user) {
+    s->sampleFn = fn;
+    s->sampleUser = user;
+    s->sampleInterval = interval;
+    if(s->cpu) session_attach(s);
+}
+
+int apex_session_record(ApexSession* s, const char* path) {
+    s->record = fopen(path, "w");
+    if(!s->record) return FALSE;
+    s->recordPath = path;
+    session_write_header(s);
+    return TRUE;
+}
+
+// Simulates up to cycles cycles, stopping early once the CPU halts or the
+// debugger stops it. Logged inputs are applied as their cycles come up, so
+// stepping after a seek follows the recording. Returns the number of
+// cycles simulated.
+long long apex_session_step(ApexSession* s, long long cycles) {
+    long long done = 0;
+    if(s->debug) s->debug->stop = APEX_STOP_NONE;
+    session_apply_due(s);
+    while(done < cycles && !cpu_halted(s->cpu) && !cpu_stopped(s->cpu)) {
+        session_snapshot(s);
+        // Run in chunks ending at the next snapshot or logged input, so the
+        // CPU can skip idle cycles inside a chunk
+        long long chunk = cycles - done;
+        long long toSnapshot = s->snapshotInterval - s->cycle % s->snapshotInterval;
+        if(chunk > toSnapshot) chunk = toSnapshot;
+        if(s->next < s->eventCount && s->events[s->next].cycle - s->cycle < chunk) chunk = s->events[s->next].cycle - s->cycle;
+        long long ran = cpu_step(s->cpu, chunk);
+        s->cycle += ran;
+        done += ran;
+        if(s->cycle > s->endCycle) s->endCycle = s->cycle;
+        session_apply_due(s);
+    }
+    return done;
+}
+
+static int session_seek_from_snapshot(ApexSession* s, long long cycle) {
+    const SessionSnapshot* best = NULL;
+    for(int k=0; k<s->snapshotCount && s->snapshots[k].cycle <= cycle; k++) best = &s->snapshots[k];
+    if(best && (cycle < s->cycle || best->cycle > s->cycle)) {
+        ApexCpu* copy = cpu_clone(best->cpu);
+        if(!copy) return FALSE;
+        cpu_destroy(s->cpu);
+        s->cpu = copy;
+        session_attach(s);
+        s->cycle = best->cycle;
+        s->next = best->event;
+    } else if(cycle < s->cycle) {
+        return FALSE;
+    }
+    apex_session_step(s, cycle - s->cycle);
+    return s->cycle == cycle;
+}
+
+// Moves to cycle (0..endCycle) from the nearest snapshot at or before it,
+// or from the current state when that is closer. The debugger and sampler
+// are detached meanwhile, so the seek lands exactly on cycle and re-run
+// cycles are not sampled twice.
+int apex_session_seek(ApexSession* s, long long cycle) {
+    if(cycle < 0 || cycle > s->endCycle) return FALSE;
+    ApexDebug* debug = s->debug;
+    ApexSampleFn sampleFn = s->sampleFn;
+    s->debug = NULL;
+    s->sampleFn = NULL;
+    session_attach(s);
+    int ok = session_seek_from_snapshot(s, cycle);
+    s->debug = debug;
+    s->sampleFn = sampleFn;
+    session_attach(s);
+    return ok;
+}
+
+void apex_session_close(ApexSession* s) {
+    if(s->record) {
+        fprintf(s->record, "%lld end\n", s->endCycle);
+        fclose(s->record);
+        s->record = NULL;
+    }
+    for(int k=0; k<s->snapshotCount; k++) cpu_destroy(s->snapshots[k].cpu);
+    s->snapshotCount = 0;
+    for(int k=0; k<s->eventCount; k++) free(s->events[k].words);
+    free(s->events);
+    s->events = NULL;
+    s->eventCount = s->eventCap = s->next = 0;
+    cpu_destroy(s->cpu);
+    s->cpu = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef APEX_SESSION_H
+#define APEX_SESSION_H
+
+#include "apex_cpu.h"
+#include "apex_results.h"
+
+// A session drives one CPU and logs every external input (memory
+// injections, fast-forwards, resets) stamped with the session cycle, the
+// count of cycles simulated since the session started. Replaying the log
+// against the same program and options reproduces the run exactly.
+// Periodic snapshots let seek() rewind without re-simulating from cycle 0.
+// A debugger stop ends apex_session_step() early; seeking ignores stops and
+// does not sample.
+
+#define SESSION_MAX_SNAPSHOTS 64
+#define SESSION_SNAPSHOT_INTERVAL 10000   // cycles, doubled whenever the snapshot table fills
+#define SESSION_ARGS_SIZE 512
+
+typedef enum {
+    SESSION_MEM,        // one word: addr, value
+    SESSION_WORDS,      // count words from addr
+    SESSION_FF,         // fast-forward value instructions
+    SESSION_INIT        // reset the CPU and reload the program
+} SessionEventKind;
+
+typedef struct {
+    long long cycle;
+    SessionEventKind kind;
+    unsigned int addr;
+    long long value;
+    int count;
+    int* words;
+} SessionEvent;
+
+typedef struct {
+    long long cycle;
+    int event;          // log entries applied before it was taken
+    ApexCpu* cpu;
+} SessionSnapshot;
+
+typedef struct {
+    ApexCpu* cpu;
+    const char* program;
+    ApexConfig config;
+    int predictor;
+    char args[SESSION_ARGS_SIZE];   // command-line options, stored in the log header
+    ResultKey programKey;           // hash of the loaded program, stored in the log header
+    int programKnown;
+    int badLine;                    // set when apex_session_load() finds a malformed log
+
+    long long cycle;
+    long long endCycle;             // furthest cycle the log covers
+    SessionEvent* events;
+    int eventCount;
+    int eventCap;
+    int next;                       // first log entry not yet applied
+
+    SessionSnapshot snapshots[SESSION_MAX_SNAPSHOTS];
+    int snapshotCount;
+    long long snapshotInterval;
+
+    FILE* record;
+    const char* recordPath;
+    // Attached to every CPU the session runs, except while seeking
+    ApexDebug* debug;
+    ApexSampleFn sampleFn;
+    void* sampleUser;
+    int sampleInterval;
+} ApexSession;
+
+// apex_session_load() reads a recorded log (and its args) into an empty
+// session, failing with badLine set if the log is malformed and 0 if it
+// cannot be opened; apex_session_start() then creates the CPU it drives,
+// and fails if the program does not match the one the log was recorded with.
+void apex_session_init(ApexSession* s);
+int apex_session_load(ApexSession* s, const char* path);
+int apex_session_start(ApexSession* s, const char* program, const ApexConfig* cfg, int predictor);
+int apex_session_record(ApexSession* s, const char* path);
+void apex_session_close(ApexSession* s);
+void apex_session_set_debugger(ApexSession* s, ApexDebug* debug);
+void apex_session_set_sampler(ApexSession* s, int interval, ApexSampleFn fn, void* user);
+
+long long apex_session_step(ApexSession* s, long long cycles);
+int apex_session_seek(ApexSession* s, long long cycle);
+void apex_session_reset(ApexSession* s);
+void apex_session_set_memory(ApexSession* s, int address, int value);
+int apex_session_load_memory(ApexSession* s, const char* path);
+long long apex_session_fast_forward(ApexSession* s, long long count);
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * apex_bench.c
+ * Benchmark harness: runs each kernel to completion and reports the modeled
+ * IPC together with host simulation speed.
+ *
+ * Build: make apex_bench
+ * Usage: ./apex_bench [-p] [-k] [-e] [-r repeats] [-s sweep] [-c cache_dir] [-o results.json] [key=value ...] [kernel.asm ...]
+ *   -k  also time every kernel on the generic cycle loop (specialize=0) and
+ *       report the specialized loop's speedup
+ *   -s key=v1,v2,...  sweep an option (repeatable, cross product); each
+ *       kernel then runs all points as one batch in rounds and again as
+ *       independent runs, and the two host speeds are compared. Points
+ *       also report their modeled dynamic energy and EDP.
+ *   -c dir  with -s, reuse finished runs from a result cache in dir and
+ *       store new ones; cached points are not simulated or timed
+ *   -e  instead of timing, check that idle skipping and the specialized
+ *       kernels leave every kernel in exactly the state of plain
+ *       cycle-by-cycle stepping: stats (less host time), registers, PC and
+ *       memory. Exits with status 1 on any difference (make check).
+ */
+
+#include "apex_cpu.h"
+#include "apex_batch.h"
+#include "apex_results.h"
+#include <time.h>
+
+static const char* defaultKernels[] = {
+    "bench/dep_chain.asm",
+    "bench/mul_heavy.asm",
+    "bench/pointer_chase.asm",
+    "bench/strided_loads.asm",
+    "bench/store_stream.asm",
+    "bench/branchy.asm",
+    "bench/call_return.asm",
+};
+
+typedef struct {
+    const char* path;
+    int completed;
+    int cycles;
+    int retired;
+    double hostSeconds;     // best of all repeats
+    ApexEnergy energy;
+} BenchResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char* kernel_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int run_kernel(const char* path, const ApexConfig* config, int predictor, int repeats, BenchResult* out) {
+    out->path = path;
+    out->hostSeconds = -1;
+    for(int r=0; r<repeats; r++) {
+        ApexCpu* cpu = cpu_create(config);
+        if(!cpu) return FALSE;
+        cpu_set_logger(cpu, NULL, NULL, APEX_LOG_ERROR);
+        if(cpu_load_program(cpu, path) < 0) { cpu_destroy(cpu); return FALSE; }
+        cpu->predictor_enabled = predictor;
+
+        double start = now_seconds();
+        cpu_run_until(cpu, NULL, NULL, 0);
+        double elapsed = now_seconds() - start;
+
+        if(out->hostSeconds < 0 || elapsed < out->hostSeconds) out->hostSeconds = elapsed;
+        out->cycles = cpu_cycles(cpu);
+        out->retired = cpu_retired(cpu);
+        out->completed = out->cycles < config->maxCycles;
+        cpu_energy(cpu, &out->energy);
+        cpu_destroy(cpu);
+    }
+    return TRUE;
+}
+
+// Final state compared by -e
+typedef struct {
+    ApexStats stats;        // recoveryHostNs cleared: it is host time
+    int cycles;
+    int arf[ARCH_REG_FILE_SIZE];
+    int pc;
+    int halted;
+    ResultKey memory;       // code and data memory
+} RunState;
+
+static int run_state(const char* path, const ApexConfig* config, int predictor, RunState* out) {
+    memset(out, 0, sizeof(RunState));
+    ApexCpu* cpu = cpu_create(config);
+    if(!cpu) return FALSE;
+    cpu_set_logger(cpu, NULL, NULL, APEX_LOG_ERROR);
+    if(cpu_load_program(cpu, path) < 0) { cpu_destroy(cpu); return FALSE; }
+    cpu->predictor_enabled = predictor;
+    cpu_run_until(cpu, NULL, NULL, 0);
+    out->stats = *cpu_stats(cpu);
+    out->stats.recoveryHostNs = 0;
+    out->cycles = cpu_cycles(cpu);
+    for(int r=0; r<ARCH_REG_FILE_SIZE; r++) out->arf[r] = cpu_read_reg(cpu, r);
+    out->pc = cpu->pc;
+    out->halted = cpu_halted(cpu);
+    out->memory = apex_results_program_key(cpu);
+    cpu_destroy(cpu);
+    return TRUE;
+}
+
+// Runs each kernel with idle_skip and specialize off (the reference) and in
+// the three other combinations. Returns the number of runs that differ, or
+// -1 on error.
+static int check_equivalence(const char** kernels, int count, const ApexConfig* config, int predictor) {
+    int failures = 0;
+    printf("\nEquivalence with cycle-by-cycle stepping (predictor %d)\n", predictor);
+    for(int k=0; k<count; k++) {
+        ApexConfig variant = *config;
+        variant.idleSkip = FALSE;
+        variant.specialize = FALSE;
+        RunState ref;
+        if(!run_state(kernels[k], &variant, predictor, &ref)) return -1;
+        printf("%-20s %10d cycles", kernel_name(kernels[k]), ref.cycles);
+        int bad = 0;
+        for(int v=1; v<4; v++) {
+            variant.idleSkip = v & 1;
+            variant.specialize = (v >> 1) & 1;
+            RunState got;
+            if(!run_state(kernels[k], &variant, predictor, &got)) return -1;
+            const char* what = got.cycles != ref.cycles || memcmp(&got.stats, &ref.stats, sizeof(ApexStats)) ? "stats"
+                             : memcmp(got.arf, ref.arf, sizeof(ref.arf)) || got.pc != ref.pc || got.halted != ref.halted ? "registers"
+                             : (got.memory.lo != ref.memory.lo || got.memory.hi != ref.memory.hi) ? "memory" : NULL;
+            if(!what) continue;
+            printf("%s idle_skip=%d specialize=%d: %s differ", bad++ ? "," : "  DIFFERS:", variant.idleSkip, variant.specialize, what);
+        }
+        printf("%s\n", bad ? "" : "  ok");
+        failures += bad;
+    }
+    return failures;
+}
+
+// Expands a "key=v1,v2,..." sweep over every config built so far
+static int expand_sweep(const char* spec, ApexConfig* configs, char (*labels)[96], int* count) {
+    const char* eq = strchr(spec, '=');
+    if(!eq) return FALSE;
+    int keyLen = (int)(eq - spec);
+    int base = *count, made = 0;
+    ApexConfig expanded[BATCH_MAX_LANES];
+    char expandedLabels[BATCH_MAX_LANES][96];
+    for(const char* v = eq + 1; *v; ) {
+        int len = (int)strcspn(v, ",");
+        for(int c=0; c<base; c++) {
+            if(made == BATCH_MAX_LANES) { printf("Error: a sweep is limited to %d points\n", BATCH_MAX_LANES); return FALSE; }
+            char option[64];
+            snprintf(option, sizeof(option), "%.*s=%.*s", keyLen, spec, len, v);
+            expanded[made] = configs[c];
+            if(!cpu_config_set(&expanded[made], option)) { printf("Error: unknown option or bad value %s\n", option); return FALSE; }
+            snprintf(expandedLabels[made], sizeof(expandedLabels[made]), "%.31s%s%.63s", labels[c], labels[c][0] ? " " : "", option);
+            made++;
+        }
+        v += len + (v[len] == ',');
+    }
+    memcpy(configs, expanded, made * sizeof(ApexConfig));
+    memcpy(labels, expandedLabels, sizeof(expandedLabels[0]) * made);
+    *count = made;
+    return TRUE;
+}
+
+// Runs a sweep as one batch, best of repeats. Returns the host seconds,
+// or a negative value on error; lane results go to out.
+static double time_batch(const char* path, const ApexConfig* configs, int count, int predictor, int repeats,
+                         long long roundCycles, BenchResult* out) {
+    double best = -1;
+    for(int r=0; r<repeats; r++) {
+        ApexBatch batch;
+        if(!apex_batch_init(&batch, configs, count)) return -1;
+        batch.roundCycles = roundCycles;
+        for(int k=0; k<count; k++) cpu_set_logger(batch.lanes[k], NULL, NULL, APEX_LOG_ERROR);
+        if(!apex_batch_load_program(&batch, path, predictor)) { apex_batch_release(&batch); return -1; }
+        double start = now_seconds();
+        apex_batch_run(&batch, 0);
+        double elapsed = now_seconds() - start;
+        if(best < 0 || elapsed < best) best = elapsed;
+        for(int k=0; k<count; k++) {
+            out[k].cycles = cpu_cycles(batch.lanes[k]);
+            out[k].retired = cpu_retired(batch.lanes[k]);
+            cpu_energy(batch.lanes[k], &out[k].energy);
+        }
+        apex_batch_release(&batch);
+    }
+    return best > 0 ? best : 1e-9;
+}
+
+// Compares batch rounds against the same lanes run one after another
+// to completion, i.e. K independent scalar runs with the same footprint
+static int run_sweep(const char* path, const ApexConfig* configs, char (*labels)[96], int count, int predictor, int repeats) {
+    BenchResult lanes[BATCH_MAX_LANES], scalar[BATCH_MAX_LANES];
+    double batchSeconds = time_batch(path, configs, count, predictor, repeats, BATCH_ROUND_CYCLES, lanes);
+    double scalarSeconds = time_batch(path, configs, count, predictor, repeats, 0, scalar);
+    if(batchSeconds < 0 || scalarSeconds < 0) return FALSE;
+    long long retired = 0;
+    printf("\n%s: %d points\n", kernel_name(path), count);
+    for(int k=0; k<count; k++) {
+        printf("  %-48s %10d cycles  IPC %.3f  %9.1f nJ  EDP %10.1f nJ*us%s\n", labels[k], lanes[k].cycles,
+               lanes[k].cycles ? (double)lanes[k].retired / lanes[k].cycles : 0.0, lanes[k].energy.dynamicNj,
+               lanes[k].energy.edp * 1e15, (lanes[k].cycles != scalar[k].cycles) ? "  (differs from scalar run!)" : "");
+        retired += lanes[k].retired;
+    }
+    printf("  batch %.3f MIPS, independent %.3f MIPS, ratio %.2fx\n", retired / batchSeconds / 1e6,
+           retired / scalarSeconds / 1e6, scalarSeconds / batchSeconds);
+    return TRUE;
+}
+
+// Runs a sweep once as a batch, restoring every point the
+// cache already holds and storing the others
+static int run_cached_sweep(const char* path, const ApexConfig* configs, char (*labels)[96], int count, int predictor,
+                            ResultCache* cache) {
+    ApexBatch batch;
+    if(!apex_batch_init(&batch, configs, count)) return FALSE;
+    for(int k=0; k<count; k++) cpu_set_logger(batch.lanes[k], NULL, NULL, APEX_LOG_ERROR);
+    if(!apex_batch_load_program(&batch, path, predictor)) { apex_batch_release(&batch); return FALSE; }
+    ResultKey keys[BATCH_MAX_LANES];
+    int hit[BATCH_MAX_LANES], hits = 0;
+    double saved = cache->savedSeconds;
+    for(int k=0; k<count; k++) {
+        keys[k] = apex_results_key(batch.lanes[k]);
+        hit[k] = apex_results_lookup(cache, keys[k], batch.lanes[k]);
+        hits += hit[k];
+    }
+    double start = now_seconds();
+    apex_batch_run(&batch, 0);
+    double elapsed = now_seconds() - start;
+
+    // Each new entry is charged its share of the batch time by cycles
+    long long simulated = 0;
+    for(int k=0; k<count; k++) if(!hit[k]) simulated += cpu_cycles(batch.lanes[k]);
+    printf("\n%s: %d points\n", kernel_name(path), count);
+    for(int k=0; k<count; k++) {
+        ApexCpu* lane = batch.lanes[k];
+        if(!hit[k]) apex_results_store(cache, keys[k], lane, simulated ? elapsed * cpu_cycles(lane) / simulated : 0.0);
+        ApexEnergy energy;
+        cpu_energy(lane, &energy);
+        printf("  %-48s %10d cycles  IPC %.3f  %9.1f nJ  EDP %10.1f nJ*us%s\n", labels[k], cpu_cycles(lane),
+               cpu_cycles(lane) ? (double)cpu_retired(lane) / cpu_cycles(lane) : 0.0, energy.dynamicNj,
+               energy.edp * 1e15, hit[k] ? "  (cached)" : "");
+    }
+    printf("  cache: %d of %d points hit, %.3f s simulated, %.3f s saved\n", hits, count, elapsed, cache->savedSeconds - saved);
+    apex_batch_release(&batch);
+    return TRUE;
+}
+
+static void write_json(FILE* fp, int argc, char** argv, int predictor, BenchResult* results, int count) {
+    fprintf(fp, "{\n  \"predictor\": %d,\n  \"options\": [", predictor);
+    int first = TRUE;
+    for(int a=1; a<argc; a++) {
+        if(!strchr(argv[a], '=')) continue;
+        fprintf(fp, "%s\"%s\"", first ? "" : ", ", argv[a]);
+        first = FALSE;
+    }
+    fprintf(fp, "],\n  \"kernels\": [\n");
+    for(int k=0; k<count; k++) {
+        BenchResult* r = &results[k];
+        double seconds = r->hostSeconds > 0 ? r->hostSeconds : 1e-9;
+        fprintf(fp, "    {\"name\": \"%s\", \"completed\": %s, \"cycles\": %d, \"retired\": %d, "
+                    "\"ipc\": %.4f, \"energy_nj\": %.3f, \"power_mw\": %.3f, \"edp_js\": %.6g, "
+                    "\"host_seconds\": %.6f, \"kips\": %.1f, \"sim_cycles_per_second\": %.0f}%s\n",
+                kernel_name(r->path), r->completed ? "true" : "false", r->cycles, r->retired,
+                r->cycles ? (double)r->retired / r->cycles : 0.0, r->energy.dynamicNj, r->energy.averageMw,
+                r->energy.edp, r->hostSeconds, r->retired / seconds / 1000.0, r->cycles / seconds,
+                (k + 1 < count) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    ApexConfig config;
+    cpu_config_defaults(&config);
+    config.maxCycles = 10000000;
+    int predictor = 0, repeats = 3, compareKernels = FALSE, checkEquivalence = FALSE;
+    const char* sweeps[8];
+    int sweepCount = 0;
+    const char* jsonPath = NULL;
+    const char* cacheDir = NULL;
+    const char* kernels[64];
+    int kernelCount = 0;
+
+    for(int a=1; a<argc; a++) {
+        if(!strcmp(argv[a], "-p")) predictor = 1;
+        else if(!strcmp(argv[a], "-k")) compareKernels = TRUE;
+        else if(!strcmp(argv[a], "-e")) checkEquivalence = TRUE;
+        else if(!strcmp(argv[a], "-r") && a + 1 < argc) repeats = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "-o") && a + 1 < argc) jsonPath = argv[++a];
+        else if(!strcmp(argv[a], "-c") && a + 1 < argc) cacheDir = argv[++a];
+        else if(!strcmp(argv[a], "-s") && a + 1 < argc && sweepCount < 8) sweeps[sweepCount++] = argv[++a];
+        else if(strchr(argv[a], '=')) {
+            if(!cpu_config_set(&config, argv[a])) { printf("Error: unknown option or bad value %s\n", argv[a]); return 1; }
+        }
+        else if(kernelCount < 64) kernels[kernelCount++] = argv[a];
+    }
+    if(kernelCount == 0) {
+        kernelCount = sizeof(defaultKernels) / sizeof(defaultKernels[0]);
+        for(int k=0; k<kernelCount; k++) kernels[k] = defaultKernels[k];
+    }
+    if(repeats < 1) repeats = 1;
+    if(checkEquivalence) {
+        int failures = check_equivalence(kernels, kernelCount, &config, predictor);
+        if(failures != 0) printf("%s\n", failures < 0 ? "Error: a kernel failed to load" : "FAILED: results depend on idle_skip/specialize");
+        return failures != 0;
+    }
+
+    BenchResult results[64];
+    for(int k=0; k<kernelCount; k++) {
+        if(!run_kernel(kernels[k], &config, predictor, repeats, &results[k])) return 1;
+    }
+
+    long long totalRetired = 0;
+    double totalSeconds = 0;
+    printf("\n%-20s %10s %10s %7s %10s %12s\n", "kernel", "cycles", "retired", "IPC", "KIPS", "cycles/sec");
+    for(int k=0; k<kernelCount; k++) {
+        BenchResult* r = &results[k];
+        double seconds = r->hostSeconds > 0 ? r->hostSeconds : 1e-9;
+        printf("%-20s %10d %10d %7.3f %10.1f %12.0f%s\n", kernel_name(r->path), r->cycles, r->retired,
+               r->cycles ? (double)r->retired / r->cycles : 0.0, r->retired / seconds / 1000.0,
+               r->cycles / seconds, r->completed ? "" : "  (hit max_cycles)");
+        totalRetired += r->retired;
+        totalSeconds += r->hostSeconds;
+    }
+    printf("Aggregate host speed: %.3f MIPS (best of %d)\n", totalSeconds > 0 ? totalRetired / totalSeconds / 1e6 : 0.0, repeats);
+
+    if(compareKernels) {
+        ApexConfig generic = config;
+        generic.specialize = FALSE;
+        double genericSeconds = 0;
+        printf("\n%-20s %14s %14s %8s\n", "kernel", "generic KIPS", "selected KIPS", "speedup");
+        for(int k=0; k<kernelCount; k++) {
+            BenchResult g;
+            if(!run_kernel(kernels[k], &generic, predictor, repeats, &g)) return 1;
+            BenchResult* r = &results[k];
+            double gs = g.hostSeconds > 0 ? g.hostSeconds : 1e-9;
+            double rs = r->hostSeconds > 0 ? r->hostSeconds : 1e-9;
+            printf("%-20s %14.1f %14.1f %7.2fx%s\n", kernel_name(r->path), g.retired / gs / 1000.0,
+                   r->retired / rs / 1000.0, gs / rs, (g.cycles != r->cycles) ? "  (cycle counts differ!)" : "");
+            genericSeconds += g.hostSeconds;
+        }
+        printf("Aggregate speedup over the generic kernel: %.2fx\n", totalSeconds > 0 ? genericSeconds / totalSeconds : 0.0);
+    }
+
+    if(sweepCount > 0) {
+        static ApexConfig sweepConfigs[BATCH_MAX_LANES];
+        static char labels[BATCH_MAX_LANES][96];
+        int points = 1;
+        sweepConfigs[0] = config;
+        labels[0][0] = 0;
+        for(int w=0; w<sweepCount; w++) {
+            if(!expand_sweep(sweeps[w], sweepConfigs, labels, &points)) return 1;
+        }
+        ResultCache cache;
+        if(cacheDir && !apex_results_open(&cache, cacheDir)) {
+            printf("Error: cannot create result cache %s\n", cacheDir);
+            return 1;
+        }
+        for(int k=0; k<kernelCount; k++) {
+            int ok = cacheDir ? run_cached_sweep(kernels[k], sweepConfigs, labels, points, predictor, &cache)
+                              : run_sweep(kernels[k], sweepConfigs, labels, points, predictor, repeats);
+            if(!ok) return 1;
+        }
+        if(cacheDir) {
+            printf("\nResult cache: %lld of %lld points hit (%.1f%%), %.3f s of simulation saved\n", cache.hits,
+                   cache.lookups, cache.lookups ? 100.0 * cache.hits / cache.lookups : 0.0, cache.savedSeconds);
+        }
+    }
+
+    if(jsonPath) {
+        FILE* fp = fopen(jsonPath, "w");
+        if(!fp) { printf("Error: cannot write %s\n", jsonPath); return 1; }
+        write_json(fp, argc, argv, predictor, results, kernelCount);
+        fclose(fp);
+        printf("Results written to %s\n", jsonPath);
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+// Data-dependent branch that alternates taken / not taken every iteration
+MOVC R1, #300           // 4000 iterations
+MOVC R6, #1             // 4004
+MOVC R2, #0             // 4008 odd count
+MOVC R4, #0             // 4012
+AND R3, R1, R6          // 4016 loop: Z set when R1 is even
+BZ #12                  // 4020 -> 4032
+ADDL R2, R2, #1         // 4024 odd path
+ADDL R4, R4, #3         // 4028
+SUBL R1, R1, #1         // 4032
+BNZ #-20                // 4036 -> 4016
+HALT
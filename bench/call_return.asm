@@ -0,0 +1,19 @@
+// Recursive calls through JAL/JALP/RET with the link saved on a memory stack
+MOVC R1, #100           // 4000 outer iterations
+MOVC R10, #8000         // 4004 stack pointer
+MOVC R2, #6             // 4008 outer loop: recursion depth
+JAL R5, #4032           // 4012 call f
+SUBL R1, R1, #1         // 4016
+BNZ #-12                // 4020 -> 4008
+HALT                    // 4024
+NOP                     // 4028
+CML R2, #0              // 4032 f: done when depth reaches 0
+BZ #32                  // 4036 -> 4068
+STORE R5, R10, #0       // 4040 push link
+ADDL R10, R10, #1       // 4044
+SUBL R2, R2, #1         // 4048
+JALP R5, #-20           // 4052 call f (4032)
+SUBL R10, R10, #1       // 4056
+LOAD R5, R10, #0        // 4060 pop link
+NOP                     // 4064
+RET R5                  // 4068
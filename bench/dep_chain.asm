@@ -0,0 +1,10 @@
+// Serial ADDL dependency chain: one result per cycle at best
+MOVC R1, #500           // 4000 iterations
+MOVC R2, #0             // 4004
+ADDL R2, R2, #1         // 4008 loop
+ADDL R2, R2, #1         // 4012
+ADDL R2, R2, #1         // 4016
+ADDL R2, R2, #1         // 4020
+SUBL R1, R1, #1         // 4024
+BNZ #-20                // 4028 -> 4008
+HALT
@@ -0,0 +1,11 @@
+// MUL-dominated loop: a dependent MUL chain next to an independent MUL
+MOVC R1, #300           // 4000 iterations
+MOVC R2, #3             // 4004
+MOVC R5, #1             // 4008
+MUL R3, R2, R5          // 4012 loop
+MUL R4, R3, R5          // 4016
+MUL R6, R4, R5          // 4020
+MUL R7, R2, R2          // 4024
+SUBL R1, R1, #1         // 4028
+BNZ #-20                // 4032 -> 4012
+HALT
@@ -0,0 +1,16 @@
+// Builds a circular linked list with one node per 4 KB page, then walks it
+MOVC R1, #64            // 4000 nodes
+MOVC R2, #1000          // 4004 list base
+MOVC R3, #1000          // 4008 cursor
+ADDL R4, R3, #1031      // 4012 build: next = cursor + stride
+STORE R4, R3, #0        // 4016 mem[cursor] = next
+ADDL R3, R4, #0         // 4020 cursor = next
+SUBL R1, R1, #1         // 4024
+BNZ #-16                // 4028 -> 4012
+STORE R2, R3, #0        // 4032 close the ring
+MOVC R1, #300           // 4036 loads to chase
+ADDL R3, R2, #0         // 4040 cursor = base
+LOAD R3, R3, #0         // 4044 chase
+SUBL R1, R1, #1         // 4048
+BNZ #-8                 // 4052 -> 4044
+HALT
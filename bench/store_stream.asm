@@ -0,0 +1,16 @@
+// Back-to-back stores filling an array, then loads walking back over it
+MOVC R1, #400           // 4000 iterations
+MOVC R2, #0             // 4004 address
+STORE R1, R2, #0        // 4008 loop
+STORE R2, R2, #1        // 4012
+ADDL R2, R2, #2         // 4016 two words per iteration
+SUBL R1, R1, #1         // 4020
+BNZ #-16                // 4024 -> 4008
+MOVC R1, #400           // 4028
+MOVC R5, #0             // 4032 sum
+LOAD R3, R2, #-1        // 4036 loop, newest words first
+ADD R5, R5, R3          // 4040
+SUBL R2, R2, #2         // 4044
+SUBL R1, R1, #1         // 4048
+BNZ #-16                // 4052 -> 4036
+HALT
@@ -0,0 +1,10 @@
+// Independent loads at a fixed stride, summed into one register
+MOVC R1, #400           // 4000 iterations
+MOVC R2, #0             // 4004 address
+MOVC R5, #0             // 4008 sum
+LOAD R3, R2, #0         // 4012 loop
+ADD R5, R5, R3          // 4016
+ADDL R2, R2, #16        // 4020 stride in words
+SUBL R1, R1, #1         // 4024
+BNZ #-16                // 4028 -> 4012
+HALT
@@ -22,7 +22,7 @@ RET R5
 
 ADDL R2, R2, #4
 ADDL R9, R7, #1
-STR R9, R2, R0
+STORE R9, R2, #0
 RET R8
 NOP
 NOP
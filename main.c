@@ -2,29 +2,165 @@
  * main.c
  */
 
-#include "apex_cpu.h"
+#include "apex_session.h"
+#include "apex_metrics.h"
+
+// A predictor flag or a key=value machine option, from the command line or
+// a session log header
+static int parse_option(const char* arg, ApexConfig* config, int* predictorFlag) {
+    if(strchr(arg, '=')) {
+        if(!cpu_config_set(config, arg)) {
+            printf("Error: unknown option or bad value %s\n", arg);
+            return FALSE;
+        }
+    } else {
+        *predictorFlag = atoi(arg);
+    }
+    return TRUE;
+}
+
+// Prints why the debugger ended the last run, if it did
+static void report_stop(ApexCpu* cpu, const ApexDebug* debug) {
+    switch(debug->stop) {
+        case APEX_STOP_NONE: return;
+        case APEX_STOP_BREAK:
+            printf("Breakpoint: PC %d retired at cycle %d\n", debug->stopPc, cpu->clock);
+            break;
+        case APEX_STOP_WATCH:
+            printf("Watchpoint: PC %d wrote address %u (%d -> %d) at cycle %d\n",
+                   debug->stopPc, debug->stopAddr, debug->stopOld, debug->stopNew, cpu->clock);
+            break;
+        case APEX_STOP_RETIRED:
+            printf("Stopped: %d instructions retired (PC %d) at cycle %d\n", cpu->instructionsRetired, debug->stopPc, cpu->clock);
+            break;
+        case APEX_STOP_REG:
+            printf("Stopped: R%d = %d after PC %d at cycle %d\n", debug->condReg, cpu->arf[debug->condReg], debug->stopPc, cpu->clock);
+            break;
+    }
+}
+
+// "R<n> <op> <value>" from the remaining strtok tokens
+static int parse_reg_condition(const char* reg, ApexDebug* debug) {
+    static const char* ops[] = {"==", "!=", "<", "<=", ">", ">="};
+    char* op = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if(!reg || (reg[0] != 'R' && reg[0] != 'r') || !op || !value) return FALSE;
+    int r = atoi(reg + 1);
+    if(r < 0 || r >= ARCH_REG_FILE_SIZE) return FALSE;
+    for(int k=0; k<6; k++) {
+        if(!strcmp(op, ops[k])) {
+            apex_debug_set_until(debug, 0, r, (ApexCondOp)k, atoi(value));
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
 
 int main(int argc, char* argv[]) {
-    // Allow 2 or 3 arguments
-    if (argc < 2 || argc > 3) {
-        printf("Usage: ./apex_sim <input_file> [predictor_flag]\n");
+    if (argc < 2) {
+        printf("Usage: ./apex_sim <input_file> [predictor_flag] [key=value ...]\n");
         printf("Example (Disable Pred): ./apex_sim input.asm\n");
         printf("Example (Enable Pred):  ./apex_sim input.asm 1\n");
+        printf("Example (L1I + ITLB):   ./apex_sim input.asm 1 icache_size=256 itlb_entries=4\n");
+        printf("Sessions: record=<log> logs inputs, replay=<log> reruns one headlessly,\n");
+        printf("          snapshot_interval=<cycles> sets how often seek snapshots are taken\n");
+        printf("Metrics:  metrics=<name> publishes live counters to shared memory for apex_top,\n");
+        printf("          metrics_interval=<cycles> sets how often\n");
+        printf("Debugger: break <pc>, watch <addr>, delete, continue,\n");
+        printf("          until cycle <n> | retired <n> | R<n> <op> <value>\n");
         return 1;
     }
 
-    ApexCpu* cpu = (ApexCpu*)malloc(sizeof(ApexCpu));
-    cpu_init(cpu);
-    cpu_load_program(cpu, argv[1]);
+    // Remaining arguments are the predictor flag, machine options and the
+    // session options, which are not part of the recorded args
+    ApexConfig config;
+    cpu_config_defaults(&config);
+    int predictorFlag = 0;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* metricsName = NULL;
+    int metricsInterval = METRICS_INTERVAL;
+    ApexSession session;
+    apex_session_init(&session);
+    for (int a = 2; a < argc; a++) {
+        if (!strncmp(argv[a], "record=", 7)) {
+            recordPath = argv[a] + 7;
+        } else if (!strncmp(argv[a], "replay=", 7)) {
+            replayPath = argv[a] + 7;
+        } else if (!strncmp(argv[a], "metrics=", 8)) {
+            metricsName = argv[a] + 8;
+        } else if (!strncmp(argv[a], "metrics_interval=", 17)) {
+            metricsInterval = atoi(argv[a] + 17);
+            if (metricsInterval < 1) metricsInterval = METRICS_INTERVAL;
+        } else if (!strncmp(argv[a], "snapshot_interval=", 18)) {
+            session.snapshotInterval = atoll(argv[a] + 18);
+            if (session.snapshotInterval < 1) session.snapshotInterval = SESSION_SNAPSHOT_INTERVAL;
+        } else {
+            if (!parse_option(argv[a], &config, &predictorFlag)) return 1;
+            size_t used = strlen(session.args);
+            snprintf(session.args + used, sizeof(session.args) - used, "%s%s", used ? " " : "", argv[a]);
+        }
+    }
+
+    // A replay takes its options from the log, not the command line
+    if (replayPath) {
+        if (!apex_session_load(&session, replayPath)) {
+            if (session.badLine) printf("Error: %s:%d: malformed session log\n", replayPath, session.badLine);
+            else printf("Error: cannot open session %s\n", replayPath);
+            apex_session_close(&session);
+            return 1;
+        }
+        cpu_config_defaults(&config);
+        predictorFlag = 0;
+        char args[SESSION_ARGS_SIZE];
+        strcpy(args, session.args);
+        for (char* arg = strtok(args, " "); arg; arg = strtok(NULL, " ")) {
+            if (!parse_option(arg, &config, &predictorFlag)) {
+                apex_session_close(&session);
+                return 1;
+            }
+        }
+    }
+
+    printf("APEX CPU Initialized\n");
+    if (!apex_session_start(&session, argv[1], &config, predictorFlag == 1)) {
+        apex_session_close(&session);
+        return 1;
+    }
+    if (recordPath && !apex_session_record(&session, recordPath)) {
+        printf("Error: cannot write session %s\n", recordPath);
+        apex_session_close(&session);
+        return 1;
+    }
+    ApexCpu* cpu = session.cpu;
+    ApexDebug debug;
+    apex_debug_init(&debug);
+    apex_session_set_debugger(&session, &debug);
+    ApexMetrics metrics;
+    memset(&metrics, 0, sizeof(metrics));
+    if (metricsName) {
+        if (!apex_metrics_open(&metrics, metricsName, argv[1], metricsInterval)) {
+            printf("Error: cannot create metrics ring %s\n", metricsName);
+            apex_session_close(&session);
+            return 1;
+        }
+        apex_session_set_sampler(&session, metricsInterval, apex_metrics_sample, &metrics);
+    }
     
     // Check optional argument to enable predictors
-    if (argc == 3 && atoi(argv[2]) == 1) {
-        cpu->predictor_enabled = TRUE;
+    if (predictorFlag == 1) {
         printf("--- PREDICTOR ENABLED ---\n");
     } else {
-        cpu->predictor_enabled = FALSE;
         printf("--- PREDICTOR DISABLED ---\n");
     }
+
+    if (replayPath) {
+        apex_session_seek(&session, session.endCycle);
+        cpu = session.cpu;
+        printf("Replayed %d inputs over %lld cycles from %s\n", session.eventCount, session.cycle, replayPath);
+        cpu_display(cpu);
+        cpu_display_stats(cpu);
+    }
     
     char command[64];
     int running = 1;
@@ -36,8 +172,9 @@ int main(int argc, char* argv[]) {
         char* cmd = strtok(command, " ");
         
         if(!cmd) {
-            cpu_simulate_cycle(cpu);
+            apex_session_step(&session, 1);
             cpu_display(cpu);
+            report_stop(cpu, &debug);
             if (cpu->simulationHalted) {
                 printf("\n--- Simulation Complete. Exiting CLI. ---\n");
                 running = 0;
@@ -46,22 +183,17 @@ int main(int argc, char* argv[]) {
         }
         
         if(!strcmp(cmd, "initialize")) {
-            cpu_init(cpu);
-            cpu_load_program(cpu, argv[1]);
-            // Restore predictor setting after reset
-            if (argc == 3 && atoi(argv[2]) == 1) cpu->predictor_enabled = TRUE;
-            else cpu->predictor_enabled = FALSE;
-            
+            // Reloads the program and restores the predictor setting
+            printf("APEX CPU Initialized\n");
+            apex_session_reset(&session);
             printf("System Initialized.\n");
         }
         else if(!strcmp(cmd, "simulate")) {
             char* arg = strtok(NULL, " ");
             int cycles = arg ? atoi(arg) : 1;
-            for(int i=0; i<cycles; i++) {
-                cpu_simulate_cycle(cpu);
-                if (cpu->simulationHalted) break;
-            }
+            apex_session_step(&session, cycles);
             cpu_display(cpu);
+            report_stop(cpu, &debug);
             if (cpu->simulationHalted) {
                 printf("\n--- Simulation Complete. Exiting CLI. ---\n");
                 running = 0;
@@ -70,23 +202,106 @@ int main(int argc, char* argv[]) {
         else if(!strcmp(cmd, "display")) {
             cpu_display(cpu);
         }
+        else if(!strcmp(cmd, "fastforward")) {
+            char* arg = strtok(NULL, " ");
+            long long count = arg ? atoll(arg) : 1;
+            long long done = apex_session_fast_forward(&session, count);
+            if(done >= 0) printf("Fast-forwarded %lld instructions, PC now %d\n", done, cpu->pc);
+            if (cpu->simulationHalted) {
+                printf("\n--- Simulation Complete. Exiting CLI. ---\n");
+                running = 0;
+            }
+        }
+        else if(!strcmp(cmd, "seek")) {
+            // seek <cycle>: rewind or advance to a session cycle, replaying logged inputs
+            char* arg = strtok(NULL, " ");
+            long long target = arg ? atoll(arg) : -1;
+            if(apex_session_seek(&session, target)) {
+                cpu = session.cpu;
+                printf("Session now at cycle %lld\n", session.cycle);
+                cpu_display(cpu);
+            } else {
+                cpu = session.cpu;
+                printf("Error: seek needs a cycle in 0..%lld\n", session.endCycle);
+            }
+        }
+        else if(!strcmp(cmd, "break")) {
+            // break <pc>: stop once the instruction at pc retires
+            char* arg = strtok(NULL, " ");
+            if(arg && apex_debug_set_break(&debug, atoi(arg), TRUE)) printf("Breakpoint set at PC %d\n", atoi(arg));
+            else printf("Error: break needs a code address\n");
+        }
+        else if(!strcmp(cmd, "watch")) {
+            // watch <addr>: stop once a store writes the data word at addr
+            char* arg = strtok(NULL, " ");
+            if(arg && apex_debug_set_watch(&debug, (unsigned int)strtoul(arg, NULL, 10), TRUE)) printf("Watchpoint set on address %s\n", arg);
+            else printf("Error: watch needs an address (at most %d watchpoints)\n", DEBUG_MAX_WATCHES);
+        }
+        else if(!strcmp(cmd, "delete")) {
+            apex_debug_init(&debug);
+            printf("Breakpoints and watchpoints deleted\n");
+        }
+        else if(!strcmp(cmd, "continue") || !strcmp(cmd, "until")) {
+            // continue: run to the next stop; until cycle N | retired N | R<n> <op> <value>
+            // runs to that point, or an earlier breakpoint or watchpoint
+            long long cycles = (long long)cpu->config.maxCycles - cpu->clock + 1;
+            int ok = TRUE;
+            if(!strcmp(cmd, "until")) {
+                char* what = strtok(NULL, " ");
+                if(what && !strcmp(what, "cycle")) {
+                    char* arg = strtok(NULL, " ");
+                    cycles = arg ? atoll(arg) - cpu->clock : 0;
+                    ok = cycles > 0;
+                } else if(what && !strcmp(what, "retired")) {
+                    char* arg = strtok(NULL, " ");
+                    long long retired = arg ? atoll(arg) : 0;
+                    apex_debug_set_until(&debug, retired, -1, APEX_COND_EQ, 0);
+                    ok = retired > cpu->instructionsRetired;
+                } else {
+                    ok = parse_reg_condition(what, &debug) && !apex_debug_cond_holds(&debug, cpu->arf[debug.condReg]);
+                }
+            }
+            if(ok) {
+                apex_session_step(&session, cycles);
+                cpu_display(cpu);
+                report_stop(cpu, &debug);
+                if (cpu->simulationHalted) {
+                    printf("\n--- Simulation Complete. Exiting CLI. ---\n");
+                    running = 0;
+                }
+            } else {
+                printf("Error: until needs cycle N, retired N or R<n> <op> <value>, not yet reached\n");
+            }
+            apex_debug_set_until(&debug, 0, -1, APEX_COND_EQ, 0);
+        }
+        else if(!strcmp(cmd, "stats")) {
+            cpu_display_stats(cpu);
+        }
+        else if(!strcmp(cmd, "profile")) {
+            // profile [listing_file] [folded_file]: annotated source, then folded stacks
+            char* listingPath = strtok(NULL, " ");
+            char* foldedPath = strtok(NULL, " ");
+            FILE* listing = listingPath ? fopen(listingPath, "w") : stdout;
+            if(listing) {
+                cpu_profile_listing(cpu, argv[1], listing);
+                if(listing != stdout) fclose(listing);
+            }
+            FILE* folded = foldedPath ? fopen(foldedPath, "w") : NULL;
+            if(folded) {
+                cpu_profile_folded(cpu, folded);
+                fclose(folded);
+            }
+            if(!listing || (foldedPath && !folded)) printf("Error: cannot write profile output\n");
+        }
         else if(!strcmp(cmd, "setmem")) {
             char* arg1 = strtok(NULL, " ");
             char* arg2 = strtok(NULL, " ");
             if(arg1 && arg2) {
-                cpu_set_memory(cpu, atoi(arg1), atoi(arg2));
+                apex_session_set_memory(&session, atoi(arg1), atoi(arg2));
             } else if (arg1) {
-                FILE* fp = fopen(arg1, "r");
-                if(fp) {
-                    char line[32];
-                    int addr = 0;
-                    while(fgets(line, sizeof(line), fp)) {
-                       if(strlen(line) > 1) {
-                           cpu_set_memory(cpu, addr++, atoi(line));
-                       }
-                    }
-                    fclose(fp);
-                    printf("Loaded memory from %s\n", arg1);
+                int loaded = apex_session_load_memory(&session, arg1);
+                if(loaded >= 0) {
+                    printf("Loaded %d words of memory from %s\n", loaded, arg1);
                 } else {
                     printf("Error: Invalid arguments or file not found.\n");
                 }
@@ -95,8 +310,10 @@ int main(int argc, char* argv[]) {
         else if(!strcmp(cmd, "single_step")) {
             printf("--- Single Step Mode ---\n");
             while(!cpu->simulationHalted) {
-                cpu_simulate_cycle(cpu);
+                apex_session_step(&session, 1);
                 cpu_display_all_stages(cpu);
+                report_stop(cpu, &debug);
+                if(cpu_stopped(cpu)) break;
                 printf("Press Enter to advance (or type 'q' to stop)...\n");
                 char c[10];
                 fgets(c, 10, stdin);
@@ -111,8 +328,9 @@ int main(int argc, char* argv[]) {
             running = 0;
         }
         else {
-            cpu_simulate_cycle(cpu);
+            apex_session_step(&session, 1);
             cpu_display(cpu);
+            report_stop(cpu, &debug);
             if (cpu->simulationHalted) {
                 printf("\n--- Simulation Complete. Exiting CLI. ---\n");
                 running = 0;
@@ -120,6 +338,9 @@ int main(int argc, char* argv[]) {
         }
     }
     
-    free(cpu);
+    // A last record, so viewers see the final counters
+    apex_metrics_publish(&metrics, session.cpu);
+    apex_metrics_close(&metrics);
+    apex_session_close(&session);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+/*
+ * apex_top.c
+ * Live viewer for a running simulation's metrics ring (apex_sim metrics=<name>).
+ *
+ * Build: make apex_top
+ * Usage: ./apex_top [-1] [-i milliseconds] <name>
+ *   -1  print the latest interval once and exit
+ *   -i  refresh period, default 1000 ms
+ *
+ * Each refresh compares the newest record with the one shown before it, so
+ * the interval column covers everything since the previous refresh.
+ */
+
+#include "apex_metrics.h"
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+static double ratio(int64_t num, int64_t den) {
+    return den ? (double)num / den : 0.0;
+}
+
+static void print_rate(const char* label, int64_t accesses, int64_t misses, int64_t totalAccesses, int64_t totalMisses) {
+    if(totalAccesses == 0) return;
+    printf("%-18s %11.2f%% %11.2f%%\n", label, 100.0 * (1.0 - ratio(misses, accesses)),
+           100.0 * (1.0 - ratio(totalMisses, totalAccesses)));
+}
+
+static void print_frame(const MetricsRing* ring, const MetricsRecord* prev, const MetricsRecord* cur, int clear) {
+    MetricsRecord zero;
+    memset(&zero, 0, sizeof(zero));
+    if(!prev) prev = &zero;
+    int64_t cycles = cur->cycle - prev->cycle;
+    double seconds = prev->hostNs ? (cur->hostNs - prev->hostNs) * 1e-9 : 0.0;
+    if(clear) printf("\033[H\033[J");
+    printf("apex_top: %s (pid %d), a record every %d cycles, %llu records%s\n\n", ring->program, ring->pid,
+           ring->interval, (unsigned long long)ring->published, cur->halted ? ", halted" : "");
+    printf("%-18s %12s %12s\n", "", "interval", "total");
+    printf("%-18s %12lld %12lld\n", "Cycles", (long long)cycles, (long long)cur->cycle);
+    printf("%-18s %12lld %12lld\n", "Retired", (long long)(cur->retired - prev->retired), (long long)cur->retired);
+    printf("%-18s %12.3f %12.3f\n", "IPC", ratio(cur->retired - prev->retired, cycles), ratio(cur->retired, cur->cycle));
+    if(seconds > 0) printf("%-18s %12.3f\n", "Host MIPS", (cur->retired - prev->retired) / seconds / 1e6);
+    printf("%-18s %12.2f %12.2f   now %d of %d\n", "ROB occupancy", ratio(cur->robOccupancy - prev->robOccupancy, cycles),
+           ratio(cur->robOccupancy, cur->cycle), cur->robCount, ROB_SIZE);
+    printf("%-18s %12.2f %12.2f   of %d\n", "RS occupancy", ratio(cur->rsOccupancy - prev->rsOccupancy, cycles),
+           ratio(cur->rsOccupancy, cur->cycle), INT_RS_SIZE + MUL_RS_SIZE);
+    printf("%-18s %12.2f %12.2f   now %d of %d\n", "LSQ occupancy", ratio(cur->lsqOccupancy - prev->lsqOccupancy, cycles),
+           ratio(cur->lsqOccupancy, cur->cycle), cur->lsqCount, LSQ_SIZE);
+    if(cur->branches > 0) {
+        printf("%-18s %11.2f%% %11.2f%%\n", "Mispredict rate",
+               100.0 * ratio(cur->branchMispredicts - prev->branchMispredicts, cur->branches - prev->branches),
+               100.0 * ratio(cur->branchMispredicts, cur->branches));
+    }
+    print_rate("L1I hit rate", cur->icacheAccesses - prev->icacheAccesses, cur->icacheMisses - prev->icacheMisses,
+               cur->icacheAccesses, cur->icacheMisses);
+    print_rate("ITLB hit rate", cur->itlbAccesses - prev->itlbAccesses, cur->itlbMisses - prev->itlbMisses,
+               cur->itlbAccesses, cur->itlbMisses);
+    print_rate("DTLB hit rate", cur->dtlbAccesses - prev->dtlbAccesses, cur->dtlbMisses - prev->dtlbMisses,
+               cur->dtlbAccesses, cur->dtlbMisses);
+    fflush(stdout);
+}
+
+// Newest readable record, retrying while the publisher laps the reader
+static int read_latest(const MetricsRing* ring, MetricsRecord* out) {
+    for(int attempt=0; attempt<8; attempt++) {
+        uint64_t published = __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE);
+        if(published == 0) return FALSE;
+        if(apex_metrics_read(ring, published - 1, out)) return TRUE;
+    }
+    return FALSE;
+}
+
+int main(int argc, char* argv[]) {
+    int once = FALSE, periodMs = 1000;
+    const char* name = NULL;
+    for(int a=1; a<argc; a++) {
+        if(!strcmp(argv[a], "-1")) once = TRUE;
+        else if(!strcmp(argv[a], "-i") && a + 1 < argc) periodMs = atoi(argv[++a]);
+        else name = argv[a];
+    }
+    if(!name || periodMs < 1) {
+        printf("Usage: ./apex_top [-1] [-i milliseconds] <name>\n");
+        return 1;
+    }
+    const MetricsRing* ring = apex_metrics_attach(name);
+    if(!ring) {
+        printf("Error: no metrics ring %s (start apex_sim with metrics=%s)\n", name, name);
+        return 1;
+    }
+
+    MetricsRecord prev, cur;
+    int havePrev = FALSE;
+    if(once) {
+        // The interval is the last one the publisher completed
+        uint64_t published = __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE);
+        havePrev = published >= 2 && apex_metrics_read(ring, published - 2, &prev);
+        if(read_latest(ring, &cur)) print_frame(ring, havePrev ? &prev : NULL, &cur, FALSE);
+        else printf("No records yet\n");
+        apex_metrics_detach(ring);
+        return 0;
+    }
+
+    struct timespec period = {periodMs / 1000, (periodMs % 1000) * 1000000L};
+    for(;;) {
+        if(read_latest(ring, &cur) && (!havePrev || cur.cycle != prev.cycle)) {
+            print_frame(ring, havePrev ? &prev : NULL, &cur, TRUE);
+            prev = cur;
+            havePrev = TRUE;
+        }
+        if(havePrev && prev.halted) break;
+        if(kill(ring->pid, 0) != 0 && errno == ESRCH) {
+            printf("\nSimulator exited\n");
+            break;
+        }
+        nanosleep(&period, NULL);
+    }
+    apex_metrics_detach(ring);
+    return 0;
+}